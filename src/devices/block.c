@@ -3,7 +3,45 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Devices whose driver has a start operation get a request
+   queue, served by a dispatch thread per device.
+
+   The dispatch thread serves requests in C-SCAN order: it picks
+   the request with the lowest sector at or past the end of the
+   previous transfer, wrapping around to the lowest sector once
+   there is none, so that the disk head sweeps in one direction.
+   A request whose deadline has passed is served first instead,
+   so that none starves.  Before starting a transfer, the thread
+   merges in pending requests in the same direction for adjacent
+   sectors, so that the driver can serve them with a single
+   command.
+
+   Devices with a remap operation, i.e. partitions, have no
+   queue of their own: their requests go into the queue of the
+   device that holds them, so that they are sorted and merged
+   with each other.
+
+   The queue is also touched by block_complete() in interrupt
+   context, so it is protected by disabling interrupts.
+
+   Each device also keeps a struct iostat.  A request counts as
+   submitted when it is queued, or when the transfer starts for a
+   device without a queue, and as complete just before its
+   completion function is called.  Statistics are updated with
+   interrupts off, so that readers see a consistent snapshot. */
+
+/* Ticks a read or write may wait before it is served ahead of
+   the C-SCAN order.  Reads usually have a thread waiting on
+   them; writes are usually write-behind. */
+#define READ_DEADLINE (TIMER_FREQ / 20)
+#define WRITE_DEADLINE (TIMER_FREQ / 2)
 
 /* A block device. */
 struct block
@@ -17,8 +55,24 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct iostat stats;                /* I/O statistics. */
+    block_sector_t last_end;            /* Sector after the last request
+                                           submitted. */
+    unsigned pending;                   /* Requests submitted but not
+                                           completed. */
+    uint64_t busy_start;                /* When PENDING became nonzero. */
+
+    /* Request queue, if ops->start is non-null. */
+    struct list queue;                  /* Pending requests, oldest
+                                           first. */
+    struct list batches[BLOCK_DEPTH_MAX]; /* Batches being transferred;
+                                           empty if unused. */
+    size_t in_flight;                   /* Number of batches in use. */
+    size_t depth;                       /* Maximum batches in flight. */
+    size_t max_requests;                /* Maximum requests per batch. */
+    block_sector_t head;                /* Sector after the last batch. */
+    struct semaphore dispatch_wait;     /* Up'd on submit and
+                                           completion. */
   };
 
 /* List of all block devices. */
@@ -28,6 +82,8 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static thread_func dispatch_thread NO_RETURN;
+static void submit_request (struct block *, struct block_request *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,21 +169,181 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are valid
+   offsets within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector,
+               block_sector_t cnt)
+{
+  if (cnt > block->size || sector > block->size - cnt)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", "
+           "count=%"PRDSNu", size=%"PRDSNu")\n",
+           block_name (block), sector, cnt, block->size);
+}
+
+/* Accounts for the submission to BLOCK of a request for the
+   CNT sectors starting at SECTOR, in the direction given by
+   WRITE.  Interrupts must be off. */
+static void
+account_submit (struct block *block, block_sector_t sector,
+                block_sector_t cnt, bool write)
+{
+  struct iostat *s = &block->stats;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (write)
+    {
+      s->write_bytes += (unsigned long long) cnt * BLOCK_SECTOR_SIZE;
+      s->write_requests++;
+    }
+  else
+    {
+      s->read_bytes += (unsigned long long) cnt * BLOCK_SECTOR_SIZE;
+      s->read_requests++;
+    }
+  if (sector == block->last_end)
+    s->sequential++;
+  else
+    s->random++;
+  block->last_end = sector + cnt;
+
+  if (block->pending++ == 0)
+    block->busy_start = timer_rdtsc ();
+  if (block->pending > s->max_pending)
+    s->max_pending = block->pending;
+}
+
+/* Accounts for the completion of a request to BLOCK submitted at
+   time-stamp counter value SUBMITTED.  Interrupts must be off. */
+static void
+account_complete (struct block *block, uint64_t submitted)
+{
+  struct iostat *s = &block->stats;
+  uint64_t now = timer_rdtsc ();
+  uint64_t latency = now - submitted;
+  int bucket = 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (block->pending > 0);
+
+  while (bucket < IOSTAT_BUCKETS - 1 && latency >> (bucket + 1) != 0)
+    bucket++;
+  s->latency[bucket]++;
+  if (latency > s->max_latency)
+    s->max_latency = latency;
+
+  if (--block->pending == 0)
+    s->busy_tsc += now - block->busy_start;
+}
+
+/* Transfers the CNT sectors starting at SECTOR between BLOCK,
+   whose driver has no start operation, and BUFFER, in the
+   direction given by WRITE. */
+static void
+transfer_direct (struct block *block, block_sector_t sector,
+                 block_sector_t cnt, void *buffer_, bool write)
+{
+  uint8_t *buffer = buffer_;
+  unsigned long long commands;
+  enum intr_level old_level;
+  uint64_t submitted;
+  block_sector_t i;
+
+  old_level = intr_disable ();
+  submitted = timer_rdtsc ();
+  account_submit (block, sector, cnt, write);
+  intr_set_level (old_level);
+
+  if (write)
+    {
+      if (block->ops->write_multi != NULL)
+        block->ops->write_multi (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             buffer + i * BLOCK_SECTOR_SIZE);
+      commands = block->ops->write_multi != NULL ? 1 : cnt;
+    }
+  else
+    {
+      if (block->ops->read_multi != NULL)
+        block->ops->read_multi (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            buffer + i * BLOCK_SECTOR_SIZE);
+      commands = block->ops->read_multi != NULL ? 1 : cnt;
+    }
+
+  old_level = intr_disable ();
+  block->stats.commands += commands;
+  account_complete (block, submitted);
+  intr_set_level (old_level);
+}
+
+/* Completion function for transfer(): wakes up the waiting
+   thread. */
+static void
+wake_waiter (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Transfers the CNT sectors starting at SECTOR between BLOCK and
+   BUFFER, in the direction given by WRITE, and waits until the
+   transfer is done. */
+static void
+transfer (struct block *block, block_sector_t sector, block_sector_t cnt,
+          void *buffer_, bool write)
+{
+  uint8_t *buffer = buffer_;
+
+  if (block->ops->start == NULL && block->ops->remap == NULL)
+    {
+      transfer_direct (block, sector, cnt, buffer, write);
+      return;
+    }
+
+  while (cnt > 0)
+    {
+      struct block_request r;
+      struct semaphore done;
+
+      r.sector = sector;
+      r.cnt = cnt < BLOCK_REQUEST_MAX ? cnt : BLOCK_REQUEST_MAX;
+      r.buffer = buffer;
+      r.write = write;
+      r.complete = wake_waiter;
+      r.aux = &done;
+      sema_init (&done, 0);
+      block_submit (block, &r);
+      sema_down (&done);
+
+      sector += r.cnt;
+      buffer += r.cnt * BLOCK_SECTOR_SIZE;
+      cnt -= r.cnt;
+    }
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
+   BUFFER must be at a kernel virtual address, because the
+   transfer may be done by another thread, or by DMA.
    Internally synchronizes accesses to block devices, so external
    per-block device locking is unneeded. */
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
   check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer (block, sector, 1, buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the block device has
    acknowledged receiving the data.
+   BUFFER must be at a kernel virtual address, because the
+   transfer may be done by another thread, or by DMA.
    Internally synchronizes accesses to block devices, so external
    per-block device locking is unneeded. */
 void
@@ -135,8 +351,277 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer (block, sector, 1, (void *) buffer, true);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Uses as few requests as the driver allows.
+   BUFFER must be at a kernel virtual address, because the
+   transfer may be done by another thread, or by DMA.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector,
+                  block_sector_t cnt, void *buffer)
+{
+  check_sectors (block, sector, cnt);
+  transfer (block, sector, cnt, buffer, false);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Uses as few requests as the driver allows.  Returns after the
+   block device has acknowledged receiving the data.
+   BUFFER must be at a kernel virtual address, because the
+   transfer may be done by another thread, or by DMA.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector,
+                   block_sector_t cnt, const void *buffer)
+{
+  check_sectors (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  transfer (block, sector, cnt, (void *) buffer, true);
+}
+
+/* Completion function for requests submitted to a device with
+   a remap operation: accounts for the request on that device
+   and hands it back to the submitter's completion function. */
+static void
+remap_complete (struct block_request *r)
+{
+  enum intr_level old_level = intr_disable ();
+  account_complete (r->upper, r->submitted);
+  intr_set_level (old_level);
+
+  r->sector = r->upper_sector;
+  r->complete = r->upper_complete;
+  r->complete (r);
+}
+
+/* Submits request R, which is described with struct
+   block_request, to BLOCK and returns without waiting for it,
+   if BLOCK's driver supports that.  Otherwise, does the
+   transfer and calls R's completion function before
+   returning. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  enum intr_level old_level;
+
+  check_sectors (block, r->sector, r->cnt);
+  ASSERT (r->cnt > 0 && r->cnt <= BLOCK_REQUEST_MAX);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+  ASSERT (is_kernel_vaddr (r->buffer));
+
+  if (block->ops->remap != NULL)
+    {
+      struct block *lower;
+
+      old_level = intr_disable ();
+      account_submit (block, r->sector, r->cnt, r->write);
+      intr_set_level (old_level);
+
+      r->upper = block;
+      r->upper_sector = r->sector;
+      r->upper_complete = r->complete;
+      lower = block->ops->remap (block->aux, &r->sector);
+      ASSERT (lower->ops->remap == NULL);
+      r->complete = remap_complete;
+      submit_request (lower, r);
+    }
+  else
+    {
+      r->upper = NULL;
+      submit_request (block, r);
+    }
+}
+
+/* Submits request R to BLOCK, which has no remap operation. */
+static void
+submit_request (struct block *block, struct block_request *r)
+{
+  enum intr_level old_level;
+
+  check_sectors (block, r->sector, r->cnt);
+  if (block->ops->start == NULL)
+    {
+      transfer_direct (block, r->sector, r->cnt, r->buffer, r->write);
+      r->complete (r);
+      return;
+    }
+
+  old_level = intr_disable ();
+  r->deadline = timer_ticks () + (r->write ? WRITE_DEADLINE : READ_DEADLINE);
+  r->submitted = timer_rdtsc ();
+  list_push_back (&block->queue, &r->elem);
+  account_submit (block, r->sector, r->cnt, r->write);
+  intr_set_level (old_level);
+  sema_up (&block->dispatch_wait);
+}
+
+/* Lets BLOCK's driver start up to DEPTH batches, of up to
+   MAX_REQUESTS requests each, without waiting for the previous
+   ones to complete.  The defaults are 1 and BLOCK_REQUEST_MAX. */
+void
+block_set_queue_limits (struct block *block, size_t depth,
+                        size_t max_requests)
+{
+  ASSERT (depth >= 1 && depth <= BLOCK_DEPTH_MAX);
+  ASSERT (max_requests >= 1);
+  block->depth = depth;
+  block->max_requests = max_requests;
+}
+
+/* Called by BLOCK's driver when BATCH, which was passed to its
+   start operation, has been transferred.  Calls the completion
+   function of each request in the batch and lets the dispatch
+   thread start another.  May be called from an interrupt
+   handler. */
+void
+block_complete (struct block *block, struct list *batch)
+{
+  enum intr_level old_level = intr_disable ();
+
+  ASSERT (!list_empty (batch));
+  while (!list_empty (batch))
+    {
+      struct block_request *r = list_entry (list_pop_front (batch),
+                                            struct block_request, elem);
+      account_complete (block, r->submitted);
+      r->complete (r);
+    }
+  block->in_flight--;
+  intr_set_level (old_level);
+  sema_up (&block->dispatch_wait);
+}
+
+/* Returns the next request in BLOCK's queue to serve, which must
+   not be empty: the one whose deadline passed first, if any,
+   otherwise the next one in C-SCAN order.  Interrupts must be
+   off. */
+static struct block_request *
+pick_request (struct block *block)
+{
+  struct block_request *expired = NULL, *next = NULL, *lowest = NULL;
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Reads and writes have different deadlines, so the request
+     whose deadline passed first need not be the oldest. */
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (now >= r->deadline
+          && (expired == NULL || r->deadline < expired->deadline))
+        expired = r;
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+      if (r->sector >= block->head
+          && (next == NULL || r->sector < next->sector))
+        next = r;
+    }
+  if (expired != NULL)
+    return expired;
+  return next != NULL ? next : lowest;
+}
+
+/* Moves request FIRST from BLOCK's queue into BATCH, along
+   with any pending requests in the same direction that extend
+   it into a longer run of sectors, up to BLOCK_REQUEST_MAX
+   sectors and BLOCK's maximum number of requests in all.
+   Interrupts must be off. */
+static void
+build_batch (struct block *block, struct list *batch,
+             struct block_request *first)
+{
+  block_sector_t start = first->sector;
+  block_sector_t end = first->sector + first->cnt;
+  size_t request_cnt = 1;
+  bool merged;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&first->elem);
+  list_push_back (batch, &first->elem);
+  do
+    {
+      struct list_elem *e;
+
+      merged = false;
+      if (request_cnt >= block->max_requests)
+        break;
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                elem);
+          if (r->write != first->write
+              || end - start + r->cnt > BLOCK_REQUEST_MAX)
+            continue;
+          if (r->sector == end)
+            {
+              list_remove (&r->elem);
+              list_push_back (batch, &r->elem);
+              end += r->cnt;
+            }
+          else if (r->sector + r->cnt == start)
+            {
+              list_remove (&r->elem);
+              list_push_front (batch, &r->elem);
+              start = r->sector;
+            }
+          else
+            continue;
+          request_cnt++;
+          merged = true;
+          break;
+        }
+    }
+  while (merged);
+  block->head = end;
+}
+
+/* Dispatch thread for BLOCK_, a struct block with a request
+   queue: hands batches of requests to the driver, keeping up to
+   BLOCK's depth of them in flight. */
+static void
+dispatch_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      enum intr_level old_level;
+
+      sema_down (&block->dispatch_wait);
+      old_level = intr_disable ();
+      while (block->in_flight < block->depth
+             && !list_empty (&block->queue))
+        {
+          struct list *batch = block->batches;
+          struct block_request *first;
+
+          while (!list_empty (batch))
+            batch++;
+          build_batch (block, batch, pick_request (block));
+          block->in_flight++;
+          block->stats.commands++;
+          first = list_entry (list_front (batch), struct block_request, elem);
+          if (first->upper != NULL)
+            first->upper->stats.commands++;
+          intr_set_level (old_level);
+
+          block->ops->start (block->aux, batch);
+          old_level = intr_disable ();
+        }
+      intr_set_level (old_level);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +645,19 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Copies BLOCK's I/O statistics into *STATS, which must be in
+   kernel memory, because it is written with interrupts off and
+   so must not page fault. */
+void
+block_get_stats (struct block *block, struct iostat *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = block->stats;
+  if (block->pending > 0)
+    stats->busy_tsc += timer_rdtsc () - block->busy_start;
+  intr_set_level (old_level);
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -169,12 +667,41 @@ block_print_stats (void)
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
-      if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+      struct iostat s;
+      unsigned long long requests;
+      int64_t busy_us;
+      int b;
+
+      if (block == NULL)
+        continue;
+
+      block_get_stats (block, &s);
+      printf ("%s (%s): %llu reads, %llu writes\n",
+              block->name, block_type_name (block->type),
+              s.read_bytes / BLOCK_SECTOR_SIZE,
+              s.write_bytes / BLOCK_SECTOR_SIZE);
+
+      requests = s.read_requests + s.write_requests;
+      if (requests == 0)
+        continue;
+      printf ("  %llu bytes read in %llu requests, "
+              "%llu bytes written in %llu requests\n",
+              s.read_bytes, s.read_requests, s.write_bytes, s.write_requests);
+      printf ("  %llu commands, %llu sequential, %llu random, "
+              "at most %u pending\n",
+              s.commands, s.sequential, s.random, s.max_pending);
+      busy_us = timer_tsc_to_ns (s.busy_tsc) / 1000;
+      printf ("  busy %"PRId64" us, longest request %"PRId64" us",
+              busy_us, timer_tsc_to_ns (s.max_latency) / 1000);
+      if (busy_us > 0)
+        printf (", %llu kB/s while busy",
+                (s.read_bytes + s.write_bytes) * 1000000 / 1024
+                / (unsigned long long) busy_us);
+      printf ("\n  latency (log2 cycles):");
+      for (b = 0; b < IOSTAT_BUCKETS; b++)
+        if (s.latency[b] != 0)
+          printf (" %d:%llu", b, s.latency[b]);
+      printf ("\n");
     }
 }
 
@@ -189,6 +716,8 @@ block_register (const char *name, enum block_type type,
                 const struct block_operations *ops, void *aux)
 {
   struct block *block = malloc (sizeof *block);
+  size_t i;
+
   if (block == NULL)
     PANIC ("Failed to allocate memory for block device descriptor");
 
@@ -198,8 +727,18 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  block->last_end = 0;
+  block->pending = 0;
+  block->busy_start = 0;
+  list_init (&block->queue);
+  for (i = 0; i < BLOCK_DEPTH_MAX; i++)
+    list_init (&block->batches[i]);
+  block->in_flight = 0;
+  block->depth = 1;
+  block->max_requests = BLOCK_REQUEST_MAX;
+  block->head = 0;
+  sema_init (&block->dispatch_wait, 0);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -208,6 +747,13 @@ block_register (const char *name, enum block_type type,
     printf (", %s", extra_info);
   printf ("\n");
 
+  if (ops->start != NULL)
+    {
+      char thread_name[sizeof block->name + 3];
+      snprintf (thread_name, sizeof thread_name, "%s-io", block->name);
+      thread_create (thread_name, PRI_MAX, dispatch_thread, block);
+    }
+
   return block;
 }
 
@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <iostat.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,10 +56,57 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, block_sector_t cnt,
+                       void *);
+void block_write_multi (struct block *, block_sector_t, block_sector_t cnt,
+                        const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* An asynchronous block request.
+
+   The submitter fills in SECTOR, CNT, BUFFER, WRITE, COMPLETE
+   and AUX, and passes the request to block_submit(), which
+   returns without waiting.  The other members belong to the
+   block layer.  COMPLETE is called when the transfer
+   is done, possibly from an interrupt handler, so it must not
+   sleep.  The request belongs to the block layer until then.
+
+   Requests are not served in submission order, so requests
+   for overlapping sectors that are pending at the same time may
+   be served in any order. */
+struct block_request
+  {
+    struct list_elem elem;      /* Element in the device's queue. */
+    block_sector_t sector;      /* First sector. */
+    block_sector_t cnt;         /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes, at a
+                                   kernel virtual address. */
+    bool write;                 /* True to write, false to read. */
+    int64_t deadline;           /* Serve by this timer tick. */
+    uint64_t submitted;         /* Time-stamp counter when submitted. */
+    void (*complete) (struct block_request *); /* Completion function. */
+    void *aux;                  /* For COMPLETE's use. */
+
+    /* If the request was submitted to a device with a remap
+       operation, that device and the request's original SECTOR
+       and COMPLETE, restored on completion. */
+    struct block *upper;
+    block_sector_t upper_sector;
+    void (*upper_complete) (struct block_request *);
+  };
+
+/* Maximum number of sectors in a block request, and in a batch
+   of requests passed to a driver's start operation. */
+#define BLOCK_REQUEST_MAX 128
+
+/* Maximum number of batches a device may have in flight. */
+#define BLOCK_DEPTH_MAX 8
+
+void block_submit (struct block *, struct block_request *);
+
 /* Statistics. */
+void block_get_stats (struct block *, struct iostat *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
@@ -65,10 +115,41 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors with a single
+       request.  If null, the block layer falls back to one
+       read or write call per sector. */
+    void (*read_multi) (void *aux, block_sector_t, block_sector_t cnt,
+                        void *buffer);
+    void (*write_multi) (void *aux, block_sector_t, block_sector_t cnt,
+                         const void *buffer);
+
+    /* Optional.  If present, the device gets a request queue and
+       the operations above are not used.  Transfers BATCH, a
+       list of struct block_requests in the same direction that
+       cover consecutive sectors, at most BLOCK_REQUEST_MAX in
+       all.  Called from a kernel thread, so it may sleep.  The
+       driver must call block_complete() once the transfer is
+       done, from its interrupt handler or before returning.
+       Unless the driver raises the limit with
+       block_set_queue_limits(), only one batch is started at a
+       time. */
+    void (*start) (void *aux, struct list *batch);
+
+    /* Optional.  If present, the device is a window onto part of
+       another one, such as a partition, and the operations above
+       are not used.  Returns the underlying device and converts
+       *SECTOR to its numbering.  Requests are queued on the
+       underlying device, so that they are sorted and merged with
+       its other requests. */
+    struct block *(*remap) (void *aux, block_sector_t *sector);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_set_queue_limits (struct block *, size_t depth,
+                             size_t max_requests);
+void block_complete (struct block *, struct list *batch);
 
 #endif /* devices/block.h */
@@ -5,13 +5,22 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the channels belong to a PCI IDE controller with bus
+   master support, such as the PIIX that QEMU emulates, disks
+   that support DMA transfer data with READ DMA and WRITE DMA.
+   Otherwise, and whenever a DMA transfer fails, data moves by
+   PIO. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +43,22 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus master IDE register addresses, relative to the channel's
+   bus master base. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits.  ERR and IRQ are cleared by
+   writing 1s to them. */
+#define BM_STA_ERR 0x02         /* Transfer failed. */
+#define BM_STA_IRQ 0x04         /* Disk raised its interrupt. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +74,15 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Maximum number of sectors in one read or write command.
+   A sector count register value of 0 means this many. */
+#define MAX_TRANSFER_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,8 +91,24 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt with READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    bool dma;                   /* Use READ/WRITE DMA? */
+    struct block *block;        /* Block device, once registered. */
   };
 
+/* A bus master IDE physical region descriptor: one physically
+   contiguous piece of a DMA transfer.  A piece may not cross a
+   64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+
 /* An ATA channel (aka controller).
    Each channel can control up to two disks. */
 struct channel
@@ -72,6 +122,12 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base I/O port, or 0. */
+    struct prd *prdt;           /* PRD table, if bm_base != 0. */
+    struct ata_disk *dma_disk;  /* Disk doing a DMA transfer, or null. */
+    struct list *dma_batch;     /* Batch being transferred by DMA. */
+    bool dma_ok;                /* Did the last DMA transfer succeed? */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -84,11 +140,20 @@ static struct block_operations ide_operations;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
-
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void set_multiple_mode (struct ata_disk *, int cnt);
+static void init_bus_master (void);
+
+static void select_sector (struct ata_disk *, block_sector_t,
+                           block_sector_t cnt);
+static void issue_command (struct channel *, uint8_t command);
+static void input_sectors (struct channel *, void *, block_sector_t cnt);
+static void output_sectors (struct channel *, const void *,
+                            block_sector_t cnt);
+static void pio_transfer (struct ata_disk *, struct list *batch,
+                          block_sector_t, block_sector_t cnt, bool write);
+static void dma_start (struct ata_disk *, struct list *batch,
+                       block_sector_t, block_sector_t cnt, bool write);
+static void dma_finish (struct channel *, uint8_t status);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -103,6 +168,8 @@ ide_init (void)
 {
   size_t chan_no;
 
+  init_bus_master ();
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -123,7 +190,7 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      lock_init_named (&c->lock, c->name);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
  
@@ -136,6 +203,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -157,6 +226,33 @@ ide_init (void)
 
 /* Disk detection and identification. */
 
+/* Looks for a PCI IDE controller with bus master support.  If
+   there is one, enables bus mastering and sets up each channel's
+   bus master registers and PRD table.  Must be called before the
+   disks are identified. */
+static void
+init_bus_master (void)
+{
+  struct pci_dev pci;
+  uint16_t bm_base;
+  size_t chan_no;
+
+  if (!pci_find_class (0x01, 0x01, 0, &pci))
+    return;
+  bm_base = pci_io_base (&pci, 4);
+  if (bm_base == 0)
+    return;
+  pci_enable_master (&pci);
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      c->prdt = palloc_get_page (0);
+      if (c->prdt != NULL)
+        c->bm_base = bm_base + chan_no * 8;
+    }
+}
+
 static char *descramble_ata_string (char *, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -272,14 +368,14 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,12 +399,38 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Use DMA if both the disk and the controller can. */
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+
+  /* Transfer as many sectors per interrupt as the disk allows. */
+  if ((uint8_t) id[47 * 2] > 0)
+    set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  d->block = block;
   partition_scan (block);
 }
 
+/* Sends a SET MULTIPLE MODE command to disk D, so that READ
+   MULTIPLE and WRITE MULTIPLE transfer CNT sectors per
+   interrupt.  Leaves D's multiple member 0 if the disk rejects
+   the command. */
+static void
+set_multiple_mode (struct ata_disk *d, int cnt)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +459,79 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Transfers BATCH, a list of block requests in the same
+   direction for consecutive sectors, between disk D and memory
+   with a single command: by DMA if possible, otherwise by PIO.
+   For a DMA transfer, interrupt_handler() completes the
+   requests; otherwise, this function does.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_start (void *d_, struct list *batch)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
-}
+  struct block_request *first = list_entry (list_front (batch),
+                                            struct block_request, elem);
+  block_sector_t sec_no = first->sector;
+  bool write = first->write;
+  block_sector_t cnt = 0;
+  bool aligned = true;
+  struct list_elem *e;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      cnt += r->cnt;
+      if ((uintptr_t) r->buffer % 2 != 0)
+        aligned = false;
+    }
+  ASSERT (cnt <= MAX_TRANSFER_SECTORS);
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
-{
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  if (d->dma && aligned)
+    {
+      /* BATCH may be gone once the transfer completes. */
+      dma_start (d, batch, sec_no, cnt, write);
+      sema_down (&c->completion_wait);
+      if (c->dma_ok)
+        {
+          lock_release (&c->lock);
+          return;
+        }
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->dma = false;
+    }
+  pio_transfer (d, batch, sec_no, cnt, write);
   lock_release (&c->lock);
+  block_complete (d->block, batch);
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    ide_start,
+    NULL
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT, which must be between
+   1 and MAX_TRANSFER_SECTORS, to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_TRANSFER_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_TRANSFER_SECTORS);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,7 +542,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
@@ -414,20 +552,155 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Transfers BATCH, which covers the CNT sectors starting at
+   SEC_NO, between disk D and memory in PIO mode with a single
+   command: from memory to the disk if WRITE is true, otherwise
+   the other way around.  With READ/WRITE MULTIPLE, the disk
+   interrupts once per D->multiple sectors; otherwise, READ/WRITE
+   SECTOR interrupts once per sector.  D's channel lock must be
+   held. */
+static void
+pio_transfer (struct ata_disk *d, struct list *batch, block_sector_t sec_no,
+              block_sector_t cnt, bool write)
+{
+  struct channel *c = d->channel;
+  block_sector_t per_irq = d->multiple > 0 ? d->multiple : 1;
+  block_sector_t done = 0;
+  struct list_elem *e;
+  uint8_t command;
+
+  if (write)
+    command = d->multiple > 0 ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY;
+  else
+    command = d->multiple > 0 ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY;
+  select_sector (d, sec_no, cnt);
+  issue_command (c, command);
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      uint8_t *sector = r->buffer;
+      block_sector_t i;
+
+      for (i = 0; i < r->cnt; i++, done++, sector += BLOCK_SECTOR_SIZE)
+        {
+          /* The disk has a block of up to PER_IRQ sectors ready
+             for reads, or wants one for writes. */
+          if (done % per_irq == 0)
+            {
+              if (!write)
+                sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+                       write ? "write" : "read", sec_no + done);
+            }
+
+          if (write)
+            {
+              output_sectors (c, sector, 1);
+              if ((done + 1) % per_irq == 0 || done + 1 == cnt)
+                sema_down (&c->completion_wait);
+            }
+          else
+            input_sectors (c, sector, 1);
+        }
+    }
+}
+
+/* Fills in channel C's PRD table to describe the buffers of the
+   requests in BATCH, splitting each at 64 kB boundaries.  Each
+   buffer is at a kernel virtual address, so it is physically
+   contiguous. */
+static void
+build_prdt (struct channel *c, struct list *batch)
+{
+  struct prd *prd = c->prdt;
+  struct list_elem *e;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      const uint8_t *buffer = r->buffer;
+      size_t size = r->cnt * BLOCK_SECTOR_SIZE;
+
+      while (size > 0)
+        {
+          uintptr_t addr = vtop (buffer);
+          size_t n = 0x10000 - (addr & 0xffff);
+          if (n > size)
+            n = size;
+
+          ASSERT (prd < c->prdt + PGSIZE / sizeof *prd);
+          prd->addr = addr;
+          prd->size = n & 0xffff;
+          prd->flags = 0;
+          prd++;
+
+          buffer += n;
+          size -= n;
+        }
+    }
+  prd[-1].flags = PRD_EOT;
+}
+
+/* Starts a bus master DMA transfer of BATCH, which covers the CNT
+   sectors starting at SEC_NO, between disk D and memory: from
+   memory to the disk if WRITE is true, otherwise the other way
+   around.  The buffers must be word-aligned.  D's channel lock
+   must be held.  interrupt_handler() calls dma_finish() when the
+   disk is done. */
+static void
+dma_start (struct ata_disk *d, struct list *batch, block_sector_t sec_no,
+           block_sector_t cnt, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+
+  build_prdt (c, batch);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_IRQ);
+
+  select_sector (d, sec_no, cnt);
+  c->dma_disk = d;
+  c->dma_batch = batch;
+  issue_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+}
+
+/* Stops the DMA transfer on channel C, given the disk's STATUS
+   register after the completion interrupt.  Completes the
+   transfer's requests if it succeeded.  Sets C->dma_ok to
+   indicate whether it did. */
+static void
+dma_finish (struct channel *c, uint8_t status)
+{
+  struct ata_disk *d = c->dma_disk;
+  uint8_t bm_status = inb (reg_bm_status (c));
+
+  outb (reg_bm_command (c), 0);
+  outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_IRQ);
+  c->dma_disk = NULL;
+  c->dma_ok = (bm_status & BM_STA_ERR) == 0 && (status & STA_ERR) == 0;
+  if (c->dma_ok)
+    block_complete (d->block, c->dma_batch);
+}
+
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, block_sector_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes SECTORS to channel C's data register in PIO mode.
+   SECTORS must contain CNT * BLOCK_SECTOR_SIZE bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, block_sector_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -513,7 +786,9 @@ interrupt_handler (struct intr_frame *f)
       {
         if (c->expecting_interrupt) 
           {
-            inb (reg_status (c));               /* Acknowledge interrupt. */
+            uint8_t status = inb (reg_status (c)); /* Acknowledge interrupt. */
+            if (c->dma_disk != NULL)
+              dma_finish (c, status);
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
         else
@@ -0,0 +1,143 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* This code accesses PCI configuration space with configuration
+   mechanism #1, which every PC chipset that Pintos runs on
+   supports.  It does only what the drivers need: finding a
+   function, reading its I/O base addresses and interrupt line,
+   and enabling bus mastering. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDR 0xcf8   /* Selects a configuration register. */
+#define PCI_CONFIG_DATA 0xcfc   /* Reads or writes the register. */
+
+/* Number of buses, devices per bus, functions per device. */
+#define PCI_BUS_CNT 256
+#define PCI_DEV_CNT 32
+#define PCI_FUNC_CNT 8
+
+/* Selects register REG of function D in the configuration
+   address port. */
+static void
+select_reg (const struct pci_dev *d, uint8_t reg)
+{
+  ASSERT (reg % 4 == 0);
+  outl (PCI_CONFIG_ADDR, (0x80000000u | (d->bus << 16) | (d->dev << 11)
+                          | (d->func << 8) | reg));
+}
+
+/* Returns the 32-bit configuration register REG of function D.
+   REG must be a multiple of 4. */
+uint32_t
+pci_read_config (const struct pci_dev *d, uint8_t reg)
+{
+  select_reg (d, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit configuration register REG of function D to
+   VALUE.  REG must be a multiple of 4. */
+void
+pci_write_config (const struct pci_dev *d, uint8_t reg, uint32_t value)
+{
+  select_reg (d, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Scans every PCI function in bus order and stores the IDX'th
+   (counting from 0) for which MATCH returns true in *D.
+   Returns true if successful, false if there are not that many
+   matches. */
+static bool
+pci_find (bool (*match) (const struct pci_dev *, uint32_t, uint32_t),
+          uint32_t a, uint32_t b, int idx, struct pci_dev *d)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < PCI_BUS_CNT; bus++)
+    for (dev = 0; dev < PCI_DEV_CNT; dev++)
+      for (func = 0; func < PCI_FUNC_CNT; func++)
+        {
+          d->bus = bus;
+          d->dev = dev;
+          d->func = func;
+          if ((pci_read_config (d, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No function 0 means no device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+          if (match (d, a, b) && idx-- == 0)
+            return true;
+
+          /* Only multi-function devices have functions past 0. */
+          if (func == 0
+              && !(pci_read_config (d, PCI_REG_HEADER) & 0x00800000))
+            break;
+        }
+  return false;
+}
+
+/* pci_find() match function for pci_find_class(). */
+static bool
+match_class (const struct pci_dev *d, uint32_t class, uint32_t subclass)
+{
+  uint32_t reg = pci_read_config (d, PCI_REG_CLASS);
+  return (reg >> 24) == class && ((reg >> 16) & 0xff) == subclass;
+}
+
+/* Stores the IDX'th PCI function with the given CLASS and
+   SUBCLASS codes in *D.  Returns true if successful, false if
+   there is no such function. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, int idx, struct pci_dev *d)
+{
+  return pci_find (match_class, class, subclass, idx, d);
+}
+
+/* pci_find() match function for pci_find_id(). */
+static bool
+match_id (const struct pci_dev *d, uint32_t vendor, uint32_t device)
+{
+  return pci_read_config (d, PCI_REG_ID) == ((device << 16) | vendor);
+}
+
+/* Stores the IDX'th PCI function with the given VENDOR and
+   DEVICE IDs in *D.  Returns true if successful, false if there
+   is no such function. */
+bool
+pci_find_id (uint16_t vendor, uint16_t device, int idx, struct pci_dev *d)
+{
+  return pci_find (match_id, vendor, device, idx, d);
+}
+
+/* Returns the I/O port base of base address register BAR of
+   function D, or 0 if BAR is unused or maps memory. */
+uint16_t
+pci_io_base (const struct pci_dev *d, int bar)
+{
+  uint32_t reg;
+
+  ASSERT (bar >= 0 && bar < 6);
+  reg = pci_read_config (d, PCI_REG_BAR0 + bar * 4);
+  return (reg & 1) != 0 ? reg & 0xfffc : 0;
+}
+
+/* Returns the ISA interrupt line that function D is routed
+   to. */
+uint8_t
+pci_irq (const struct pci_dev *d)
+{
+  return pci_read_config (d, PCI_REG_INTR) & 0xff;
+}
+
+/* Lets function D respond to I/O accesses and initiate DMA. */
+void
+pci_enable_master (const struct pci_dev *d)
+{
+  uint32_t reg = pci_read_config (d, PCI_REG_COMMAND);
+  pci_write_config (d, PCI_REG_COMMAND,
+                    (reg & 0xffff) | PCI_CMD_IO | PCI_CMD_MASTER);
+}
@@ -0,0 +1,39 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Location of a PCI function. */
+struct pci_dev
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t dev;                /* Device number, 0...31. */
+    uint8_t func;               /* Function number, 0...7. */
+  };
+
+/* Configuration space registers. */
+#define PCI_REG_ID 0x00         /* Vendor ID (low), device ID (high). */
+#define PCI_REG_COMMAND 0x04    /* Command (low), status (high). */
+#define PCI_REG_CLASS 0x08      /* Revision, prog IF, subclass, class. */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 23:16. */
+#define PCI_REG_BAR0 0x10       /* First of six base address registers. */
+#define PCI_REG_INTR 0x3c       /* Interrupt line in bits 7:0. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* Bus master enable. */
+
+uint32_t pci_read_config (const struct pci_dev *, uint8_t reg);
+void pci_write_config (const struct pci_dev *, uint8_t reg, uint32_t);
+
+bool pci_find_class (uint8_t class, uint8_t subclass, int idx,
+                     struct pci_dev *);
+bool pci_find_id (uint16_t vendor, uint16_t device, int idx,
+                  struct pci_dev *);
+
+uint16_t pci_io_base (const struct pci_dev *, int bar);
+uint8_t pci_irq (const struct pci_dev *);
+void pci_enable_master (const struct pci_dev *);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,151 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is a driver for RAM disks: block devices
+   whose contents live in memory and vanish at shutdown.  They
+   take the place of the swap or scratch disk when disk latency
+   would get in the way, e.g. to measure the software overhead
+   of swapping.
+
+   A RAM disk's storage is a set of pages from the kernel pool,
+   so that it does not take frames away from user processes.
+   The pages need not be contiguous; each holds
+   SECTORS_PER_PAGE sectors.  Transfers are synchronous
+   memcpy()s, so the block layer does not queue requests for RAM
+   disks. */
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    char name[8];               /* Name, e.g. "ram0". */
+    size_t page_cnt;            /* Number of pages. */
+    uint8_t **pages;            /* PAGE_CNT pages of storage. */
+  };
+
+/* Number of RAM disks created so far. */
+static int ramdisk_cnt;
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk of KB kilobytes, rounded up to a whole
+   number of pages, and registers it as a block device of type
+   ROLE, which must be BLOCK_SCRATCH or BLOCK_SWAP.  Panics if
+   there is not enough memory.
+
+   Call this before probing other block devices: they come later
+   in probe order, so the RAM disk gets ROLE unless the user
+   names another device for it. */
+void
+ramdisk_init (enum block_type role, size_t kb)
+{
+  struct ramdisk *d;
+  char extra_info[32];
+  size_t i;
+
+  ASSERT (role == BLOCK_SCRATCH || role == BLOCK_SWAP);
+  ASSERT (kb > 0);
+
+  d = malloc (sizeof *d);
+  if (d == NULL)
+    PANIC ("ramdisk: out of memory");
+  snprintf (d->name, sizeof d->name, "ram%d", ramdisk_cnt++);
+  d->page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  d->pages = malloc (d->page_cnt * sizeof *d->pages);
+  if (d->pages == NULL)
+    PANIC ("%s: out of memory", d->name);
+  for (i = 0; i < d->page_cnt; i++)
+    {
+      d->pages[i] = palloc_get_page (PAL_ZERO);
+      if (d->pages[i] == NULL)
+        PANIC ("%s: only %zu of %zu pages available "
+               "(use -ul to leave more memory to the kernel)",
+               d->name, i, d->page_cnt);
+    }
+
+  snprintf (extra_info, sizeof extra_info, "RAM disk for %s",
+            block_type_name (role));
+  block_register (d->name, role, extra_info,
+                  d->page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, d);
+}
+
+/* Copies the CNT sectors starting at SECTOR between RAM disk
+   D_ and BUFFER_, in the direction given by WRITE. */
+static void
+ramdisk_transfer (void *d_, block_sector_t sector, block_sector_t cnt,
+                  void *buffer_, bool write)
+{
+  struct ramdisk *d = d_;
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      block_sector_t page_ofs = sector % SECTORS_PER_PAGE;
+      block_sector_t chunk = SECTORS_PER_PAGE - page_ofs;
+      uint8_t *data;
+
+      if (chunk > cnt)
+        chunk = cnt;
+      data = (d->pages[sector / SECTORS_PER_PAGE]
+              + page_ofs * BLOCK_SECTOR_SIZE);
+      if (write)
+        memcpy (data, buffer, chunk * BLOCK_SECTOR_SIZE);
+      else
+        memcpy (buffer, data, chunk * BLOCK_SECTOR_SIZE);
+
+      sector += chunk;
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      cnt -= chunk;
+    }
+}
+
+/* Reads sector SEC_NO from RAM disk D into BUFFER, which must
+   have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ramdisk_transfer (d, sec_no, 1, buffer, false);
+}
+
+/* Writes sector SEC_NO to RAM disk D from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ramdisk_transfer (d, sec_no, 1, (void *) buffer, true);
+}
+
+/* Reads the CNT sectors starting at SEC_NO from RAM disk D into
+   BUFFER. */
+static void
+ramdisk_read_multi (void *d, block_sector_t sec_no, block_sector_t cnt,
+                    void *buffer)
+{
+  ramdisk_transfer (d, sec_no, cnt, buffer, false);
+}
+
+/* Writes the CNT sectors starting at SEC_NO to RAM disk D from
+   BUFFER. */
+static void
+ramdisk_write_multi (void *d, block_sector_t sec_no, block_sector_t cnt,
+                     const void *buffer)
+{
+  ramdisk_transfer (d, sec_no, cnt, (void *) buffer, true);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multi,
+    ramdisk_write_multi,
+    NULL,
+    NULL,
+  };
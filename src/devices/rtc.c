@@ -29,14 +29,18 @@
 
 /* Register A. */
 #define RTCSA_UIP	0x80	/* Set while time update in progress. */
+#define RTCSA_RATE	0x0f	/* Periodic rate: 32768 >> (RATE - 1) Hz. */
+#define RTCSA_RATE_8192	0x03	/* RATE for RTC_PERIODIC_HZ. */
 
 /* Register B. */
 #define	RTCSB_SET	0x80	/* Disables update to let time be set. */
+#define RTCSB_PIE	0x40	/* Periodic interrupt enable. */
 #define RTCSB_DM	0x04	/* 0 = BCD time format, 1 = binary format. */
 #define RTCSB_24HR	0x02    /* 0 = 12-hour format, 1 = 24-hour format. */
 
 static int bcd_to_bin (uint8_t);
 static uint8_t cmos_read (uint8_t index);
+static void cmos_write (uint8_t index, uint8_t data);
 
 /* Returns number of seconds since Unix epoch of January 1,
    1970. */
@@ -96,6 +100,30 @@ rtc_get_time (void)
   return time;
 }
 
+/* Turns the RTC's periodic interrupt, at RTC_PERIODIC_HZ, on or
+   off according to ENABLE.  Each interrupt must be acknowledged
+   with rtc_periodic_ack(), or the RTC will not raise another.
+   Must be called with interrupts off. */
+void
+rtc_periodic_enable (bool enable)
+{
+  uint8_t b;
+
+  if (enable)
+    cmos_write (RTC_REG_A, (cmos_read (RTC_REG_A) & ~RTCSA_RATE)
+                           | RTCSA_RATE_8192);
+  b = cmos_read (RTC_REG_B);
+  cmos_write (RTC_REG_B, enable ? b | RTCSB_PIE : b & ~RTCSB_PIE);
+  rtc_periodic_ack ();
+}
+
+/* Acknowledges a pending RTC interrupt by reading register C. */
+void
+rtc_periodic_ack (void)
+{
+  cmos_read (RTC_REG_C);
+}
+
 /* Returns the integer value of the given BCD byte. */
 static int
 bcd_to_bin (uint8_t x)
@@ -111,3 +139,11 @@ cmos_read (uint8_t index)
   outb (CMOS_REG_SET, index);
   return inb (CMOS_REG_IO);
 }
+
+/* Writes DATA to the CMOS register with the given INDEX. */
+static void
+cmos_write (uint8_t index, uint8_t data)
+{
+  outb (CMOS_REG_SET, index);
+  outb (CMOS_REG_IO, data);
+}
@@ -1,8 +1,16 @@
 #ifndef RTC_H
 #define RTC_H
 
+#include <stdbool.h>
+
 typedef unsigned long time_t;
 
 time_t rtc_get_time (void);
 
+/* Rate of the RTC periodic interrupt (IRQ 8), in Hz. */
+#define RTC_PERIODIC_HZ 8192
+
+void rtc_periodic_enable (bool enable);
+void rtc_periodic_ack (void);
+
 #endif
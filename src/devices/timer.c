@@ -4,6 +4,7 @@
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
+#include "devices/rtc.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
@@ -24,7 +25,53 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* PIT cycles per timer tick, as programmed by timer_init(). */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Largest count we load for a one-shot.  Kept well below 65536
+   so that a counter that has expired and wrapped around can be
+   told apart from one that is still counting down. */
+#define ONESHOT_MAX_CYCLES 60000
+
+/* Number of timer ticks over which timer_calibrate() measures
+   the TSC rate. */
+#define TSC_CALIBRATE_TICKS 4
+
+/* TSC cycles per second, or 0 until timer_calibrate() has
+   measured it, and the TSC value at the start of timer tick
+   tsc_base_tick. */
+static uint64_t tsc_hz;
+static uint64_t tsc_base;
+static int64_t tsc_base_tick;
+
+/* Sleeps shorter than this are busy-waited on the TSC, because
+   blocking would oversleep by up to an RTC period. */
+#define HR_SPIN_NS 20000
+
+/* Threads sleeping for less than a timer tick, ordered by
+   wakeup_tsc.  They are woken by the RTC periodic interrupt,
+   which is enabled only while this list is nonempty. */
+static struct list hr_sleep_list;
+
+bool timer_tickless;
+
+/* Tickless idle state.  While oneshot_ticks is nonzero, PIT
+   channel 0 is in one-shot mode, loaded with oneshot_count
+   cycles, and will interrupt at the boundary of tick
+   ticks + oneshot_ticks.  oneshot_phase is the number of cycles
+   of the current tick that had already elapsed when it was
+   loaded. */
+static int oneshot_ticks;
+static unsigned oneshot_count;
+static unsigned oneshot_phase;
+
 static intr_handler_func timer_interrupt;
+static void timer_catch_up (int64_t prev_ticks);
+static void oneshot_stop (int64_t elapsed_ticks);
+static intr_handler_func hr_timer_interrupt;
+static void hr_sleep_until (uint64_t deadline);
+static bool compare_wakeup_tsc (const struct list_elem *,
+                                const struct list_elem *, void *aux);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -37,6 +84,9 @@ timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+
+  list_init (&hr_sleep_list);
+  intr_register_ext (0x28, hr_timer_interrupt, "RTC Periodic");
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -44,6 +94,8 @@ void
 timer_calibrate (void) 
 {
   unsigned high_bit, test_bit;
+  uint64_t tsc_start, tsc_end;
+  int64_t start;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
@@ -64,6 +116,47 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  /* Count TSC cycles across TSC_CALIBRATE_TICKS whole ticks. */
+  printf ("Calibrating TSC...  ");
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  start = ticks;
+  tsc_start = timer_rdtsc ();
+  while (ticks - start < TSC_CALIBRATE_TICKS)
+    barrier ();
+  tsc_end = timer_rdtsc ();
+
+  tsc_base = tsc_start;
+  tsc_base_tick = start;
+  tsc_hz = (tsc_end - tsc_start) * TIMER_FREQ / TSC_CALIBRATE_TICKS;
+  printf ("%'"PRIu64" cycles/s.\n", tsc_hz);
+}
+
+/* Returns the number of nanoseconds since the OS booted.  Before
+   timer_calibrate(), the resolution is one timer tick. */
+int64_t
+timer_now_ns (void)
+{
+  if (tsc_hz == 0)
+    return timer_ticks () * (1000 * 1000 * 1000 / TIMER_FREQ);
+  return (tsc_base_tick * (1000 * 1000 * 1000 / TIMER_FREQ)
+          + timer_tsc_to_ns (timer_rdtsc () - tsc_base));
+}
+
+/* Converts a span of CYCLES TSC cycles into nanoseconds, or
+   returns 0 if the TSC has not been calibrated yet. */
+int64_t
+timer_tsc_to_ns (uint64_t cycles)
+{
+  if (tsc_hz == 0)
+    return 0;
+
+  /* Split off whole seconds so that the multiplication cannot
+     overflow. */
+  return (cycles / tsc_hz * 1000 * 1000 * 1000
+          + cycles % tsc_hz * 1000 * 1000 * 1000 / tsc_hz);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -165,20 +258,103 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  In tickless mode, replaces the periodic tick by a
+   one-shot that fires at the tick the next sleeping thread is
+   due, or as close to it as the 16-bit PIT counter reaches. */
+void
+timer_idle_enter (void)
+{
+  int64_t until_wakeup;
+  unsigned remaining;
+  int n;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || oneshot_ticks != 0)
+    return;
+
+  /* Cycles left until the next periodic tick. */
+  remaining = pit_read_count (0);
+  if (remaining == 0 || remaining > TICK_CYCLES)
+    return;
+
+  n = 1 + (ONESHOT_MAX_CYCLES - remaining) / TICK_CYCLES;
+  until_wakeup = get_next_tick_to_awake () - ticks;
+  if (until_wakeup < n)
+    n = until_wakeup;
+  if (n <= 1)
+    return;
+
+  oneshot_ticks = n;
+  oneshot_phase = TICK_CYCLES - remaining;
+  oneshot_count = remaining + (n - 1) * TICK_CYCLES;
+  pit_start_oneshot (0, oneshot_count);
+}
+
+/* Called with interrupts off when the idle thread is about to be
+   switched away from.  If a one-shot is still pending, credits
+   the whole ticks that elapsed since it was loaded and goes back
+   to the periodic tick.  Up to one tick of phase is lost. */
+void
+timer_idle_exit (void)
+{
+  int64_t prev_ticks = ticks;
+  unsigned count;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks == 0)
+    return;
+
+  count = pit_read_count (0);
+  if (count == 0 || count > oneshot_count)
+    {
+      /* Expired, but its interrupt has not been delivered yet.
+         That interrupt will count the last tick itself. */
+      oneshot_stop (oneshot_ticks - 1);
+    }
+  else
+    oneshot_stop ((oneshot_count - count + oneshot_phase) / TICK_CYCLES);
+  timer_catch_up (prev_ticks);
+}
+
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
+  int64_t prev_ticks = ticks;
+
+  /* A periodic tick that was already pending when the one-shot
+     was loaded arrives here as an ordinary tick; only an expired
+     one-shot ends tickless mode. */
+  if (oneshot_ticks != 0)
+    {
+      unsigned count = pit_read_count (0);
+      if (count == 0 || count > oneshot_count)
+        oneshot_stop (oneshot_ticks - 1);
+    }
+
   ticks++;
-  thread_tick ();
+  thread_tick ((args->cs & 3) == 3);
 
-  if (thread_mlfqs) {
+  if (thread_mlfqs)
     increment_recent_cpu();
-    if (ticks % TIMER_FREQ == 0){
+
+  timer_catch_up (prev_ticks);
+}
+
+/* Does the periodic work that fell due in the ticks after
+   PREV_TICKS, up to and including the current tick. */
+static void
+timer_catch_up (int64_t prev_ticks)
+{
+  if (thread_mlfqs) {
+    if (ticks / TIMER_FREQ != prev_ticks / TIMER_FREQ){
       recalculate_load_avg();
       recalculate_recent_cpu();
     }
-    if (ticks % 4 == 0) {
+    if (ticks / 4 != prev_ticks / 4) {
       recalculate_priority();
     }
   }
@@ -188,6 +364,17 @@ timer_interrupt (struct intr_frame *args UNUSED)
   }
 }
 
+/* Puts PIT channel 0 back into periodic mode and credits
+   ELAPSED_TICKS ticks that passed without a timer interrupt. */
+static void
+oneshot_stop (int64_t elapsed_ticks)
+{
+  pit_configure_channel (0, 2, TIMER_FREQ);
+  oneshot_ticks = 0;
+  ticks += elapsed_ticks;
+  thread_add_idle_ticks (elapsed_ticks);
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
@@ -232,21 +419,90 @@ real_time_sleep (int64_t num, int32_t denom)
      1 s / TIMER_FREQ ticks
   */
   int64_t ticks = num * TIMER_FREQ / denom;
+  uint64_t deadline;
 
   ASSERT (intr_get_level () == INTR_ON);
+  if (num <= 0)
+    return;
+  if (tsc_hz == 0)
+    {
+      /* No high-resolution clock yet: sleep whole ticks, or
+         busy-wait for less than one. */
+      if (ticks > 0)
+        timer_sleep (ticks);
+      else
+        real_time_delay (num, denom);
+      return;
+    }
+
+  /* Sleep the whole ticks with timer_sleep(), which wakes up at
+     a tick boundary no later than the deadline, then the
+     remainder against the TSC. */
+  deadline = (timer_rdtsc () + num / denom * tsc_hz
+              + num % denom * tsc_hz / denom);
   if (ticks > 0)
+    timer_sleep (ticks);
+  hr_sleep_until (deadline);
+}
+
+/* Blocks the running thread until the TSC reaches DEADLINE.  The
+   thread is woken by the RTC periodic interrupt, so it may
+   oversleep by up to 1/RTC_PERIODIC_HZ seconds; remainders too
+   short for that are busy-waited instead. */
+static void
+hr_sleep_until (uint64_t deadline)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  uint64_t now = timer_rdtsc ();
+
+  if (now >= deadline)
+    return;
+  if (timer_tsc_to_ns (deadline - now) < HR_SPIN_NS)
     {
-      /* We're waiting for at least one full timer tick.  Use
-         timer_sleep() because it will yield the CPU to other
-         processes. */                
-      timer_sleep (ticks); 
+      while (timer_rdtsc () < deadline)
+        barrier ();
+      return;
     }
-  else 
+
+  old_level = intr_disable ();
+  cur->wakeup_tsc = deadline;
+  if (list_empty (&hr_sleep_list))
+    rtc_periodic_enable (true);
+  list_insert_ordered (&hr_sleep_list, &cur->elem, compare_wakeup_tsc, NULL);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* RTC periodic interrupt handler.  Wakes up the sub-tick sleepers
+   whose deadline has passed. */
+static void
+hr_timer_interrupt (struct intr_frame *args UNUSED)
+{
+  uint64_t now = timer_rdtsc ();
+
+  rtc_periodic_ack ();
+  while (!list_empty (&hr_sleep_list))
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
-      real_time_delay (num, denom); 
+      struct thread *t = list_entry (list_front (&hr_sleep_list),
+                                     struct thread, elem);
+      if (t->wakeup_tsc > now)
+        break;
+      list_pop_front (&hr_sleep_list);
+      thread_unblock (t);
     }
+  if (list_empty (&hr_sleep_list))
+    rtc_periodic_enable (false);
+  thread_preemption ();
+}
+
+/* Orders threads by ascending wakeup_tsc. */
+static bool
+compare_wakeup_tsc (const struct list_elem *a, const struct list_elem *b,
+                    void *aux UNUSED)
+{
+  return (list_entry (a, struct thread, elem)->wakeup_tsc
+          < list_entry (b, struct thread, elem)->wakeup_tsc);
 }
 
 /* Busy-wait for approximately NUM/DENOM seconds. */
@@ -2,6 +2,7 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -26,4 +27,26 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* High-resolution clock, based on the CPU time-stamp counter. */
+int64_t timer_now_ns (void);
+int64_t timer_tsc_to_ns (uint64_t cycles);
+
+/* Reads the CPU's time-stamp counter.  See [IA32-v2b] "RDTSC". */
+static inline uint64_t
+timer_rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Tickless idle.  If false (default), the timer interrupts
+   TIMER_FREQ times per second at all times.  If true, the idle
+   thread stops the periodic tick until the next sleeper is due.
+   Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
+
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 #endif /* devices/timer.h */
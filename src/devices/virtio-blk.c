@@ -0,0 +1,394 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is a driver for virtio block devices,
+   the paravirtual disks that QEMU provides with "-drive
+   if=virtio".  It uses the legacy PCI interface from [VIRTIO]
+   with a single virtqueue.
+
+   Each batch of requests from the block layer becomes one
+   virtio request, described by an indirect descriptor table:
+   a header that gives the direction and first sector, one
+   descriptor per request buffer, and a status byte.  Up to
+   SLOT_CNT of these are in flight at once.  The interrupt
+   handler completes them as the device returns them in the used
+   ring. */
+
+/* PCI IDs of a legacy virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio register addresses, relative to the I/O base. */
+#define reg_device_features(D) ((D)->io_base + 0x00)  /* 32 bits. */
+#define reg_guest_features(D) ((D)->io_base + 0x04)   /* 32 bits. */
+#define reg_queue_pfn(D) ((D)->io_base + 0x08)        /* 32 bits. */
+#define reg_queue_size(D) ((D)->io_base + 0x0c)       /* 16 bits. */
+#define reg_queue_select(D) ((D)->io_base + 0x0e)     /* 16 bits. */
+#define reg_queue_notify(D) ((D)->io_base + 0x10)     /* 16 bits. */
+#define reg_status(D) ((D)->io_base + 0x12)           /* 8 bits. */
+#define reg_isr(D) ((D)->io_base + 0x13)              /* 8 bits. */
+#define reg_capacity(D) ((D)->io_base + 0x14)         /* 64 bits. */
+#define reg_seg_max(D) ((D)->io_base + 0x20)          /* 32 bits. */
+
+/* Device Status Register bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Guest found the device. */
+#define STATUS_DRIVER 0x02      /* Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver gave up on the device. */
+
+/* Feature bits. */
+#define F_SEG_MAX (1u << 2)             /* seg_max is valid. */
+#define F_RING_INDIRECT_DESC (1u << 28) /* Indirect descriptors. */
+
+/* ISR Status Register bits. */
+#define ISR_QUEUE 0x01          /* Used ring was updated. */
+
+/* Virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_* flags. */
+    uint16_t next;              /* Next descriptor, if F_NEXT. */
+  };
+
+#define VRING_DESC_F_NEXT 0x1           /* Chained to NEXT. */
+#define VRING_DESC_F_WRITE 0x2          /* Written by the device. */
+#define VRING_DESC_F_INDIRECT 0x4       /* Points to a table. */
+
+/* Virtqueue used ring element. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head descriptor of the request. */
+    uint32_t len;               /* Bytes written by the device. */
+  };
+
+/* Alignment of the used ring in a legacy virtqueue. */
+#define VRING_ALIGN PGSIZE
+
+/* Request header. */
+struct virtio_blk_hdr
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;          /* Must be 0. */
+    uint64_t sector;            /* First sector. */
+  };
+
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+#define VIRTIO_BLK_S_OK 0       /* Request succeeded. */
+
+/* Number of requests a device may have in flight. */
+#define SLOT_CNT 4
+
+/* Descriptors in a slot's table: header, a buffer for each
+   request in a batch, status. */
+#define SLOT_DESCS (BLOCK_REQUEST_MAX + 2)
+
+/* The device-visible part of a request slot.  Occupies one
+   page, so that it is physically contiguous. */
+struct slot_page
+  {
+    struct vring_desc table[SLOT_DESCS]; /* Indirect descriptors. */
+    struct virtio_blk_hdr hdr;           /* Request header. */
+    uint8_t status;                      /* Written by the device. */
+  };
+
+/* A virtio block device. */
+struct virtio_blk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt vector. */
+    struct block *block;        /* Block device, once registered. */
+    size_t max_requests;        /* Buffers per request allowed. */
+
+    /* Virtqueue.  Slot I uses descriptor I. */
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    volatile uint16_t *avail;   /* Available ring: flags, idx, ring. */
+    volatile uint16_t *used;    /* Used ring: flags, idx, then... */
+    volatile struct vring_used_elem *used_ring; /* ...elements. */
+    uint16_t last_used;         /* Used ring index we are up to. */
+
+    struct slot_page *slots[SLOT_CNT];  /* Request slots. */
+    struct list *batches[SLOT_CNT];     /* Batch in each slot, or null. */
+  };
+
+/* Maximum number of virtio block devices. */
+#define DEVICE_MAX 4
+static struct virtio_blk devices[DEVICE_MAX];
+static size_t device_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static bool init_device (struct virtio_blk *, const struct pci_dev *);
+static bool init_queue (struct virtio_blk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds virtio block devices on the PCI bus and registers them
+   with the block layer. */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev pci;
+  int idx;
+
+  for (idx = 0; device_cnt < DEVICE_MAX
+                && pci_find_id (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, idx, &pci);
+       idx++)
+    init_device (&devices[device_cnt], &pci);
+}
+
+/* Returns true if a device before D already uses D's interrupt
+   vector. */
+static bool
+irq_shared (const struct virtio_blk *d)
+{
+  const struct virtio_blk *other;
+
+  for (other = devices; other < d; other++)
+    if (other->irq == d->irq)
+      return true;
+  return false;
+}
+
+/* Resets and sets up the virtio block device found at PCI as D,
+   the next free entry in devices[], and registers it as a block
+   device.  Returns true if successful, false if the device
+   cannot be used. */
+static bool
+init_device (struct virtio_blk *d, const struct pci_dev *pci)
+{
+  uint32_t features;
+  uint64_t capacity;
+  uint8_t irq = pci_irq (pci);
+
+  ASSERT (d == &devices[device_cnt]);
+  snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) device_cnt);
+  d->io_base = pci_io_base (pci, 0);
+  if (d->io_base == 0 || irq >= 16)
+    {
+      printf ("%s: unusable PCI configuration\n", d->name);
+      return false;
+    }
+  d->irq = irq + 0x20;
+  pci_enable_master (pci);
+
+  /* Reset, then tell the device that we know how to drive it. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+
+  /* We need indirect descriptors, so that each request takes
+     only one slot in the ring. */
+  features = inl (reg_device_features (d));
+  if (!(features & F_RING_INDIRECT_DESC))
+    {
+      printf ("%s: no indirect descriptor support\n", d->name);
+      outb (reg_status (d), STATUS_FAILED);
+      return false;
+    }
+  outl (reg_guest_features (d),
+        features & (F_RING_INDIRECT_DESC | F_SEG_MAX));
+
+  /* The device may limit the buffers per request. */
+  d->max_requests = BLOCK_REQUEST_MAX;
+  if (features & F_SEG_MAX)
+    {
+      uint32_t seg_max = inl (reg_seg_max (d));
+      if (seg_max >= 1 && seg_max < d->max_requests)
+        d->max_requests = seg_max;
+    }
+
+  if (!init_queue (d))
+    {
+      printf ("%s: virtqueue setup failed\n", d->name);
+      outb (reg_status (d), STATUS_FAILED);
+      return false;
+    }
+
+  /* From here on, the interrupt handler looks at D. */
+  if (!irq_shared (d))
+    intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+  device_cnt++;
+  outb (reg_status (d),
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  /* Register. */
+  capacity = inl (reg_capacity (d));
+  capacity |= (uint64_t) inl (reg_capacity (d) + 4) << 32;
+  if (capacity > (block_sector_t) -1)
+    capacity = (block_sector_t) -1;
+  d->block = block_register (d->name, BLOCK_RAW, "virtio", capacity,
+                             &virtio_blk_operations, d);
+  block_set_queue_limits (d->block, SLOT_CNT, d->max_requests);
+  partition_scan (d->block);
+  return true;
+}
+
+/* Allocates virtqueue 0 of device D and its request slots and
+   hands the queue to the device.  Returns true if successful. */
+static bool
+init_queue (struct virtio_blk *d)
+{
+  size_t avail_ofs, used_ofs, page_cnt;
+  uint8_t *queue;
+  int i;
+
+  outw (reg_queue_select (d), 0);
+  d->queue_size = inw (reg_queue_size (d));
+  if (d->queue_size < SLOT_CNT)
+    return false;
+
+  /* Legacy layout: descriptors, then the available ring, then the
+     used ring on the next VRING_ALIGN boundary. */
+  avail_ofs = d->queue_size * sizeof (struct vring_desc);
+  used_ofs = ROUND_UP (avail_ofs + (3 + d->queue_size) * sizeof (uint16_t),
+                       VRING_ALIGN);
+  page_cnt = DIV_ROUND_UP (used_ofs + 3 * sizeof (uint16_t)
+                           + d->queue_size * sizeof (struct vring_used_elem),
+                           PGSIZE);
+  queue = palloc_get_multiple (PAL_ZERO, page_cnt);
+  if (queue == NULL)
+    return false;
+  d->desc = (struct vring_desc *) queue;
+  d->avail = (uint16_t *) (queue + avail_ofs);
+  d->used = (uint16_t *) (queue + used_ofs);
+  d->used_ring = (struct vring_used_elem *) (queue + used_ofs + 4);
+  d->last_used = 0;
+
+  /* Each slot's ring descriptor permanently points to its
+     table. */
+  for (i = 0; i < SLOT_CNT; i++)
+    {
+      d->slots[i] = palloc_get_page (PAL_ZERO);
+      if (d->slots[i] == NULL)
+        return false;
+      d->batches[i] = NULL;
+      d->desc[i].addr = vtop (d->slots[i]->table);
+      d->desc[i].flags = VRING_DESC_F_INDIRECT;
+    }
+
+  outl (reg_queue_pfn (d), vtop (queue) / PGSIZE);
+  return true;
+}
+
+/* Starts a transfer of BATCH, a list of block requests in the
+   same direction for consecutive sectors, as a single virtio
+   request on device D_.  Returns without waiting;
+   interrupt_handler() completes the requests. */
+static void
+virtio_blk_start (void *d_, struct list *batch)
+{
+  struct virtio_blk *d = d_;
+  struct block_request *first = list_entry (list_front (batch),
+                                            struct block_request, elem);
+  enum intr_level old_level;
+  struct slot_page *slot;
+  struct list_elem *e;
+  size_t desc_cnt;
+  int i;
+
+  /* The block layer keeps no more than SLOT_CNT batches in
+     flight, so there is a free slot. */
+  old_level = intr_disable ();
+  for (i = 0; i < SLOT_CNT; i++)
+    if (d->batches[i] == NULL)
+      break;
+  ASSERT (i < SLOT_CNT);
+  d->batches[i] = batch;
+  intr_set_level (old_level);
+  slot = d->slots[i];
+
+  slot->hdr.type = first->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  slot->hdr.reserved = 0;
+  slot->hdr.sector = first->sector;
+  slot->table[0].addr = vtop (&slot->hdr);
+  slot->table[0].len = sizeof slot->hdr;
+  slot->table[0].flags = VRING_DESC_F_NEXT;
+  slot->table[0].next = 1;
+  desc_cnt = 1;
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      struct vring_desc *desc = &slot->table[desc_cnt];
+
+      ASSERT (desc_cnt <= d->max_requests);
+      desc->addr = vtop (r->buffer);
+      desc->len = r->cnt * BLOCK_SECTOR_SIZE;
+      desc->flags = VRING_DESC_F_NEXT | (r->write ? 0 : VRING_DESC_F_WRITE);
+      desc->next = desc_cnt + 1;
+      desc_cnt++;
+    }
+  slot->status = 0xff;
+  slot->table[desc_cnt].addr = vtop (&slot->status);
+  slot->table[desc_cnt].len = 1;
+  slot->table[desc_cnt].flags = VRING_DESC_F_WRITE;
+  slot->table[desc_cnt].next = 0;
+  desc_cnt++;
+  d->desc[i].len = desc_cnt * sizeof (struct vring_desc);
+
+  /* Publish the request, then tell the device. */
+  old_level = intr_disable ();
+  d->avail[2 + d->avail[1] % d->queue_size] = i;
+  barrier ();
+  d->avail[1]++;
+  barrier ();
+  intr_set_level (old_level);
+  outw (reg_queue_notify (d), 0);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    virtio_blk_start,
+    NULL
+  };
+
+/* Completes the requests that device D has returned in its used
+   ring. */
+static void
+complete_requests (struct virtio_blk *d)
+{
+  while (d->last_used != d->used[1])
+    {
+      uint32_t i = d->used_ring[d->last_used % d->queue_size].id;
+      struct list *batch;
+
+      barrier ();
+      ASSERT (i < SLOT_CNT && d->batches[i] != NULL);
+      if (d->slots[i]->status != VIRTIO_BLK_S_OK)
+        PANIC ("%s: request failed, sector=%"PRIu64,
+               d->name, d->slots[i]->hdr.sector);
+      batch = d->batches[i];
+      d->batches[i] = NULL;
+      d->last_used++;
+      block_complete (d->block, batch);
+    }
+}
+
+/* Virtio block interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  struct virtio_blk *d;
+
+  for (d = devices; d < devices + device_cnt; d++)
+    if (d->irq == f->vec_no && (inb (reg_isr (d)) & ISR_QUEUE) != 0)
+      complete_requests (d);
+}
@@ -0,0 +1,468 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Buffer cache for the file system device.
+
+   Every access to a file system sector goes through one of
+   CACHE_SIZE entries.  Replacement uses the clock algorithm.
+   Dirty sectors are written back when they are evicted, by a
+   write-behind thread every FLUSH_INTERVAL ticks, and by
+   cache_flush() when the file system shuts down.  A read-ahead
+   thread loads sectors requested with cache_readahead() in the
+   background.
+
+   A dirty sector may point to sectors that were allocated after
+   the free map was last written, so every write-back first calls
+   free_map_flush(), which writes the free map to disk and waits
+   for it.  The free map itself goes through
+   cache_write_through(), which never evicts an entry and so
+   never recurses into a write-back.
+
+   cache_lock protects the mapping from sectors to entries: each
+   entry's sector, in_use, accessed and pin_cnt members, plus
+   the read-ahead queue and the statistics.  An entry's own lock
+   protects its data, valid and dirty members.  A pinned entry
+   (pin_cnt > 0) is never evicted, so a thread may pin an entry
+   under cache_lock, drop cache_lock, and then take the entry's
+   lock to do I/O on it.  No thread does I/O while holding
+   cache_lock, so that cache hits never wait for the disk. */
+
+/* Number of sectors in the cache. */
+#define CACHE_SIZE 64
+
+/* Timer ticks between write-behind passes. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+/* Maximum number of queued read-ahead requests. */
+#define READAHEAD_MAX 16
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if in_use. */
+    bool in_use;                        /* Assigned to a sector? */
+    bool accessed;                      /* Used since the clock hand
+                                           last passed? */
+    int pin_cnt;                        /* Threads using the entry. */
+
+    struct lock lock;                   /* Protects the members below. */
+    bool valid;                         /* Data read in from disk? */
+    bool dirty;                         /* Data newer than disk? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition cache_unpinned; /* Signaled when an entry
+                                           becomes evictable. */
+static size_t clock_hand;
+
+/* Read-ahead queue. */
+static block_sector_t readahead_queue[READAHEAD_MAX];
+static size_t readahead_head, readahead_cnt;
+static struct condition readahead_cond;
+
+/* Statistics. */
+static unsigned long long hit_cnt, miss_cnt;
+static unsigned long long readahead_read_cnt, write_back_cnt;
+
+/* cache_flush() state.  flush_lock serializes flushes. */
+static struct lock flush_lock;
+static struct block_request flush_requests[CACHE_SIZE];
+static struct semaphore flush_done;
+
+/* cache_write_through() buffer for sectors that are not cached.
+   through_lock protects it. */
+static struct lock through_lock;
+static uint8_t through_buffer[BLOCK_SECTOR_SIZE];
+
+static thread_func flush_thread NO_RETURN;
+static thread_func readahead_thread NO_RETURN;
+
+/* Initializes the buffer cache and starts its helper threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init_named (&cache_lock, "cache");
+  lock_init (&flush_lock);
+  lock_init (&through_lock);
+  sema_init (&flush_done, 0);
+  cond_init (&cache_unpinned);
+  cond_init (&readahead_cond);
+  for (i = 0; i < CACHE_SIZE; i++)
+    lock_init (&cache[i].lock);
+
+  thread_create ("cache-flush", PRI_DEFAULT, flush_thread, NULL);
+  thread_create ("cache-readahead", PRI_DEFAULT, readahead_thread, NULL);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if SECTOR
+   is not cached.  cache_lock must be held. */
+static struct cache_entry *
+cache_find (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Writes back E, which is in use and unpinned, if it is dirty,
+   after the free map.  Pins E and releases cache_lock during the
+   write, so that other threads can use the cache meanwhile.
+   cache_lock must be held. */
+static void
+cache_write_back (struct cache_entry *e)
+{
+  bool written = false;
+
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (e->dirty)
+    {
+      free_map_flush ();
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      written = true;
+    }
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (written)
+    write_back_cnt++;
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+}
+
+/* Picks an unpinned, clean entry with the clock algorithm and
+   returns it, no longer in use.
+
+   Returns a null pointer instead if cache_lock had to be
+   released, to wait for an entry to be unpinned if every entry
+   is pinned or to write back a dirty entry.  The caller must
+   then look up its sector again, because another thread may
+   have brought it into the cache meanwhile.  cache_lock must be
+   held. */
+static struct cache_entry *
+cache_evict (void)
+{
+  size_t pinned_cnt = 0;
+
+  for (;;)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (!e->in_use)
+        return e;
+      if (e->pin_cnt > 0)
+        {
+          if (++pinned_cnt >= CACHE_SIZE)
+            {
+              cond_wait (&cache_unpinned, &cache_lock);
+              return NULL;
+            }
+          continue;
+        }
+      pinned_cnt = 0;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+
+      /* E is unpinned, so no one holds its lock. */
+      if (e->dirty)
+        {
+          /* Try E again first once it is clean. */
+          clock_hand = e - cache;
+          cache_write_back (e);
+          return NULL;
+        }
+      e->in_use = false;
+      return e;
+    }
+}
+
+/* Returns the pinned entry for SECTOR, with its lock held and
+   its data valid.  If OVERWRITE is true, the caller will
+   overwrite the whole sector, so the old contents are not read
+   from disk.
+
+   If READ_AHEAD is true, the request comes from the read-ahead
+   thread: returns a null pointer without doing anything if
+   SECTOR is already cached. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool overwrite, bool read_ahead)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_find (sector);
+      if (e != NULL)
+        {
+          if (read_ahead)
+            {
+              lock_release (&cache_lock);
+              return NULL;
+            }
+          hit_cnt++;
+          break;
+        }
+
+      e = cache_evict ();
+      if (e != NULL)
+        {
+          if (read_ahead)
+            readahead_read_cnt++;
+          else
+            miss_cnt++;
+          e->sector = sector;
+          e->in_use = true;
+          e->valid = false;
+          break;
+        }
+    }
+  e->accessed = true;
+  e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  /* Whoever locks a new entry first fills it in. */
+  lock_acquire (&e->lock);
+  if (!e->valid)
+    {
+      if (!overwrite)
+        block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Releases and unpins E, which was obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Reads SIZE bytes starting at offset OFS within SECTOR into
+   BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, false, false);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at offset
+   OFS.  The write reaches the disk later. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, ofs == 0 && size == BLOCK_SECTOR_SIZE, false);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at offset
+   OFS, and writes the sector to disk before returning.  If
+   SECTOR is cached, its entry is updated and becomes clean;
+   otherwise it is not brought into the cache, so that no entry
+   has to be evicted for it. */
+void
+cache_write_through (block_sector_t sector, const void *buffer, int ofs,
+                     int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = cache_find (sector);
+  if (e != NULL)
+    e->pin_cnt++;
+  lock_release (&cache_lock);
+
+  if (e != NULL)
+    {
+      lock_acquire (&e->lock);
+      if (!e->valid)
+        {
+          block_read (fs_device, sector, e->data);
+          e->valid = true;
+        }
+      memcpy (e->data + ofs, buffer, size);
+      block_write (fs_device, sector, e->data);
+      e->dirty = false;
+      cache_put (e);
+    }
+  else
+    {
+      lock_acquire (&through_lock);
+      if (size < BLOCK_SECTOR_SIZE)
+        block_read (fs_device, sector, through_buffer);
+      memcpy (through_buffer + ofs, buffer, size);
+      block_write (fs_device, sector, through_buffer);
+      lock_release (&through_lock);
+    }
+}
+
+/* Asks for SECTOR to be read into the cache in the background.
+   The request is dropped if SECTOR is already cached or too
+   many requests are pending. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (readahead_cnt < READAHEAD_MAX && cache_find (sector) == NULL)
+    {
+      readahead_queue[(readahead_head + readahead_cnt++) % READAHEAD_MAX]
+        = sector;
+      cond_signal (&readahead_cond, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Completion function for cache_flush()'s write requests. */
+static void
+flush_complete (struct block_request *r UNUSED)
+{
+  sema_up (&flush_done);
+}
+
+/* Writes every dirty cached sector back to disk, after the free
+   map.  The dirty entries are locked first and the free map is
+   written next, so that it covers every allocation their data
+   can refer to.  Then all of the writes are submitted before
+   waiting for any of them, so that the block layer can sort them
+   and merge adjacent sectors into larger transfers. */
+void
+cache_flush (void)
+{
+  bool flushing[CACHE_SIZE];
+  size_t write_cnt = 0;
+  size_t i;
+
+  lock_acquire (&flush_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      flushing[i] = false;
+      lock_acquire (&cache_lock);
+      if (!e->in_use)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      /* Hold E's lock until its write is done. */
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        flushing[i] = true;
+      else
+        cache_put (e);
+    }
+
+  free_map_flush ();
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (flushing[i])
+      {
+        struct cache_entry *e = &cache[i];
+        struct block_request *r = &flush_requests[write_cnt++];
+        r->sector = e->sector;
+        r->cnt = 1;
+        r->buffer = e->data;
+        r->write = true;
+        r->complete = flush_complete;
+        block_submit (fs_device, r);
+        e->dirty = false;
+      }
+  for (i = 0; i < write_cnt; i++)
+    sema_down (&flush_done);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (flushing[i])
+      cache_put (&cache[i]);
+
+  lock_acquire (&cache_lock);
+  write_back_cnt += write_cnt;
+  lock_release (&cache_lock);
+  lock_release (&flush_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %llu hits, %llu misses, %llu read-aheads, "
+          "%llu write-backs\n",
+          hit_cnt, miss_cnt, readahead_read_cnt, write_back_cnt);
+}
+
+/* Write-behind thread: periodically writes dirty sectors back,
+   so that evictions rarely have to. */
+static void
+flush_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Read-ahead thread: loads sectors queued by
+   cache_readahead(). */
+static void
+readahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      block_sector_t sector;
+
+      lock_acquire (&cache_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_cond, &cache_lock);
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_MAX;
+      readahead_cnt--;
+      lock_release (&cache_lock);
+
+      e = cache_get (sector, false, true);
+      if (e != NULL)
+        cache_put (e);
+    }
+}
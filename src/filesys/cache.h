@@ -0,0 +1,15 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+
+void cache_init (void);
+void cache_read (block_sector_t, void *buffer, int ofs, int size);
+void cache_write (block_sector_t, const void *buffer, int ofs, int size);
+void cache_write_through (block_sector_t, const void *buffer, int ofs,
+                          int size);
+void cache_readahead (block_sector_t);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
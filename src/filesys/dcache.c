@@ -0,0 +1,144 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Maps a directory's inode sector and a name in it to the inode
+   sector the name refers to, or to DCACHE_NEGATIVE if the name
+   is known not to exist, so that repeated lookups of the same
+   names need not read the directory.  directory.c keeps the
+   cache up to date as it adds and removes entries.  At most
+   DCACHE_SIZE names are cached; the least recently used one is
+   replaced first. */
+
+/* Number of cached names. */
+#define DCACHE_SIZE 128
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Containing directory. */
+    block_sector_t sector;              /* Inode, or DCACHE_NEGATIVE. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+static struct dentry dentry_pool[DCACHE_SIZE];
+static struct hash dentries;            /* Cached names. */
+static struct list lru_list;            /* Most recently used first. */
+static struct list free_list;           /* Unused entries. */
+static struct lock dcache_lock;         /* Protects the above. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("dcache hash table creation failed");
+  list_init (&lru_list);
+  list_init (&free_list);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&free_list, &dentry_pool[i].lru_elem);
+  lock_init_named (&dcache_lock, "dcache");
+}
+
+/* Returns the cached entry for NAME in DIR, or a null pointer.
+   dcache_lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in directory DIR.  If it is cached, stores the
+   inode sector it names, or DCACHE_NEGATIVE if it does not
+   exist, into *SECTORP and returns true.  Otherwise returns
+   false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+      *sectorp = d->sector;
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in directory DIR refers to the inode in
+   SECTOR, or does not exist if SECTOR is DCACHE_NEGATIVE. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      if (!list_empty (&free_list))
+        d = list_entry (list_pop_front (&free_list), struct dentry, lru_elem);
+      else
+        {
+          d = list_entry (list_pop_back (&lru_list), struct dentry, lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+        }
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  else
+    list_remove (&d->lru_elem);
+  d->sector = sector;
+  list_push_front (&lru_list, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -1,7 +1,11 @@
 #include "filesys/directory.h"
+#include <hash.h>
+#include <round.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -21,12 +25,104 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* A directory is an extendible hash table of buckets, each one
+   sector long.  The directory's header holds a table of 2**DEPTH
+   bucket numbers, where DEPTH is the global depth, and a name is
+   stored in the bucket that the table entry for the low DEPTH
+   bits of the name's hash selects.  Each bucket has a local
+   depth of its own, at most DEPTH: all of its names have the same
+   low bits, that many of them, and the table entries for those
+   bits all select it.
+
+   When a name's bucket is full, the bucket is split in two by
+   the next bit of the hash, after doubling the table if the
+   bucket's local depth has reached the global depth.  So a
+   lookup reads the table entry and one bucket, however many
+   entries the directory has.  Buckets are never merged back.
+
+   An all-zero directory file with one bucket is an empty
+   directory, so a new directory need not be written at all. */
+
+/* Maximum global depth, which limits a directory to
+   DIR_TABLE_SIZE buckets. */
+#define DIR_MAX_DEPTH 10
+#define DIR_TABLE_SIZE (1 << DIR_MAX_DEPTH)
+
+/* Directory header, at the start of the directory file. */
+struct dir_header
+  {
+    uint32_t depth;                     /* Global depth. */
+    uint16_t table[DIR_TABLE_SIZE];     /* Bucket for each hash. */
+  };
+
+/* Offset of bucket 0 in a directory file. */
+#define DIR_BUCKETS_OFS ROUND_UP (sizeof (struct dir_header), \
+                                  BLOCK_SECTOR_SIZE)
+
+/* Entries per bucket. */
+#define DIR_BUCKET_ENTRIES ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) \
+                            / sizeof (struct dir_entry))
+
+/* One bucket. */
+struct dir_bucket
+  {
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];
+    uint32_t depth;                     /* Local depth. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - sizeof (uint32_t)
+                   - DIR_BUCKET_ENTRIES * sizeof (struct dir_entry)];
+  };
+
+/* Returns the offset of bucket IDX in a directory file. */
+static off_t
+bucket_ofs (size_t idx)
+{
+  return DIR_BUCKETS_OFS + idx * BLOCK_SECTOR_SIZE;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR.  The directory grows beyond that as needed.
+   Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header *h;
+  struct dir_bucket *b;
+  struct inode *inode;
+  size_t depth = 0;
+  size_t i;
+  bool success = false;
+
+  /* Aim for buckets half full, since hashing is not perfectly
+     even. */
+  while (depth < DIR_MAX_DEPTH
+         && ((size_t) 1 << depth) * DIR_BUCKET_ENTRIES / 2 < entry_cnt)
+    depth++;
+  if (!inode_create (sector, bucket_ofs ((size_t) 1 << depth)))
+    return false;
+  if (depth == 0)
+    return true;
+
+  /* Write a table that maps each hash to a bucket of its own. */
+  inode = inode_open (sector);
+  h = calloc (1, sizeof *h);
+  b = calloc (1, sizeof *b);
+  if (inode == NULL || h == NULL || b == NULL)
+    goto done;
+  h->depth = b->depth = depth;
+  for (i = 0; i < ((size_t) 1 << depth); i++)
+    h->table[i] = i;
+  if (inode_write_at (inode, h, sizeof *h, 0) != sizeof *h)
+    goto done;
+  for (i = 0; i < ((size_t) 1 << depth); i++)
+    if (inode_write_at (inode, b, sizeof *b, bucket_ofs (i)) != sizeof *b)
+      goto done;
+  success = true;
+
+ done:
+  free (b);
+  free (h);
+  inode_close (inode);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,34 +179,153 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+/* Returns the number of buckets in DIR. */
+static size_t
+bucket_cnt (const struct dir *dir)
+{
+  return (inode_length (dir->inode) - DIR_BUCKETS_OFS) / BLOCK_SECTOR_SIZE;
+}
+
+/* Reads bucket IDX of DIR into B.  Returns true if successful. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+read_bucket (const struct dir *dir, size_t idx, struct dir_bucket *b)
 {
-  struct dir_entry e;
-  size_t ofs;
+  return (inode_read_at (dir->inode, b, sizeof *b, bucket_ofs (idx))
+          == sizeof *b);
+}
+
+/* Writes B to bucket IDX of DIR.  Returns true if successful. */
+static bool
+write_bucket (struct dir *dir, size_t idx, const struct dir_bucket *b)
+{
+  return (inode_write_at (dir->inode, b, sizeof *b, bucket_ofs (idx))
+          == sizeof *b);
+}
+
+/* Finds the bucket of DIR for names with the given HASH and
+   stores its number in *IDX.  Returns true if successful, false
+   on a disk error. */
+static bool
+find_bucket (const struct dir *dir, unsigned hash, size_t *idx)
+{
+  uint32_t depth;
+  uint16_t entry;
+
+  if (inode_read_at (dir->inode, &depth, sizeof depth,
+                     offsetof (struct dir_header, depth)) != sizeof depth
+      || depth > DIR_MAX_DEPTH)
+    return false;
+  if (inode_read_at (dir->inode, &entry, sizeof entry,
+                     offsetof (struct dir_header, table)
+                     + (hash & ((1u << depth) - 1)) * sizeof entry)
+      != sizeof entry
+      || entry >= bucket_cnt (dir))
+    return false;
+  *idx = entry;
+  return true;
+}
+
+/* Searches DIR for a file with the given NAME, reading NAME's
+   bucket into B and setting *BUCKETP to its number, or to
+   SIZE_MAX if a disk error occurs.
+   If successful, returns true and sets *SLOTP to the slot of the
+   entry within the bucket.
+   Otherwise, returns false and sets *SLOTP to a free slot in the
+   bucket, or to SIZE_MAX if it is full. */
+static bool
+lookup (const struct dir *dir, const char *name, struct dir_bucket *b,
+        size_t *bucketp, size_t *slotp) 
+{
+  size_t idx, i;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  *bucketp = *slotp = SIZE_MAX;
+  if (!find_bucket (dir, hash_string (name), &idx)
+      || !read_bucket (dir, idx, b))
+    return false;
+
+  *bucketp = idx;
+  for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+    {
+      const struct dir_entry *e = &b->entries[i];
+      if (e->in_use)
+        {
+          if (!strcmp (name, e->name))
+            {
+              *slotp = i;
+              return true;
+            }
+        }
+      else if (*slotp == SIZE_MAX)
+        *slotp = i;
+    }
   return false;
 }
 
+/* Splits bucket IDX of DIR, whose contents are in B, moving the
+   entries whose hash has bit B->depth set into a new bucket.
+   Doubles DIR's table first if necessary.  On return, B holds
+   the remaining contents of bucket IDX.  Returns true if
+   successful, false if DIR is as large as it can get or a disk
+   or memory error occurs. */
+static bool
+split_bucket (struct dir *dir, size_t idx, struct dir_bucket *b)
+{
+  struct dir_header *h;
+  struct dir_bucket *nb;
+  size_t new_idx = bucket_cnt (dir);
+  uint32_t bit = b->depth;
+  size_t i, j;
+  bool success = false;
+
+  h = malloc (sizeof *h);
+  nb = calloc (1, sizeof *nb);
+  if (h == NULL || nb == NULL
+      || inode_read_at (dir->inode, h, sizeof *h, 0) != sizeof *h)
+    goto done;
+
+  /* Double the table if no more bits of the hash select
+     buckets. */
+  if (b->depth == h->depth)
+    {
+      if (h->depth == DIR_MAX_DEPTH)
+        goto done;
+      memcpy (h->table + (1u << h->depth), h->table,
+              (1u << h->depth) * sizeof *h->table);
+      h->depth++;
+    }
+
+  /* Move entries. */
+  b->depth = nb->depth = bit + 1;
+  for (i = j = 0; i < DIR_BUCKET_ENTRIES; i++)
+    {
+      struct dir_entry *e = &b->entries[i];
+      if (e->in_use && (hash_string (e->name) >> bit) & 1)
+        {
+          nb->entries[j++] = *e;
+          memset (e, 0, sizeof *e);
+        }
+    }
+
+  /* Point half of the table entries for bucket IDX at the new
+     bucket. */
+  for (i = 0; i < (1u << h->depth); i++)
+    if (h->table[i] == idx && (i >> bit) & 1)
+      h->table[i] = new_idx;
+
+  /* Write the new bucket before anything refers to it. */
+  success = (write_bucket (dir, new_idx, nb)
+             && write_bucket (dir, idx, b)
+             && inode_write_at (dir->inode, h, sizeof *h, 0) == sizeof *h);
+
+ done:
+  free (nb);
+  free (h);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -119,15 +334,38 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  block_sector_t dir_sector, sector;
+  struct dir_bucket *b;
+  size_t idx, slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  if (dcache_lookup (dir_sector, name, &sector))
+    {
+      if (sector != DCACHE_NEGATIVE)
+        *inode = inode_open (sector);
+      return *inode != NULL;
+    }
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  if (lookup (dir, name, b, &idx, &slot))
+    {
+      sector = b->entries[slot].inode_sector;
+      *inode = inode_open (sector);
+      dcache_insert (dir_sector, name, sector);
+    }
+  else if (idx != SIZE_MAX)
+    {
+      /* Only a bucket that was actually read shows that NAME
+         does not exist. */
+      dcache_insert (dir_sector, name, DCACHE_NEGATIVE);
+    }
+  free (b);
 
   return *inode != NULL;
 }
@@ -136,13 +374,14 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), DIR cannot grow any
+   further, or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_bucket *b;
   struct dir_entry e;
-  off_t ofs;
+  size_t idx, slot;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,29 +391,33 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Check that NAME is not in use and find a free slot,
+     splitting NAME's bucket until it has one. */
+  for (;;)
+    {
+      if (lookup (dir, name, b, &idx, &slot) || idx == SIZE_MAX)
+        goto done;
+      if (slot != SIZE_MAX)
+        break;
+      if (!split_bucket (dir, idx, b))
+        goto done;
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = inode_write_at (dir->inode, &e, sizeof e,
+                            bucket_ofs (idx) + slot * sizeof e) == sizeof e;
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
 
  done:
+  free (b);
   return success;
 }
 
@@ -184,34 +427,43 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
-  struct dir_entry e;
+  struct dir_bucket *b;
+  struct dir_entry *e;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
+  size_t idx, slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!lookup (dir, name, b, &idx, &slot))
     goto done;
+  e = &b->entries[slot];
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (e->inode_sector);
   if (inode == NULL)
     goto done;
 
   /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  memset (e, 0, sizeof *e);
+  if (inode_write_at (dir->inode, e, sizeof *e,
+                      bucket_ofs (idx) + slot * sizeof *e) != sizeof *e) 
     goto done;
 
   /* Remove inode. */
+  dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
   inode_remove (inode);
   success = true;
 
  done:
   inode_close (inode);
+  free (b);
   return success;
 }
 
@@ -223,8 +475,16 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  if (dir->pos < (off_t) DIR_BUCKETS_OFS)
+    dir->pos = DIR_BUCKETS_OFS;
+  for (;;)
     {
+      /* Skip the unused tail of each bucket. */
+      if (dir->pos % BLOCK_SECTOR_SIZE
+          >= (off_t) (DIR_BUCKET_ENTRIES * sizeof e))
+        dir->pos = ROUND_UP (dir->pos, BLOCK_SECTOR_SIZE);
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
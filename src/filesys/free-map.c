@@ -1,12 +1,58 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The free map is kept in memory and written to the free map
+   file lazily: allocations and releases only mark the sectors of
+   the file that cover the changed bits as dirty, and
+   free_map_flush() writes just those sectors.  The buffer cache
+   calls it before it writes back any other sector, so that a
+   sector never reaches the disk before the free map bit that
+   allocates it.  free_map_flush() writes the file's sectors
+   directly with cache_write_through() and waits for them,
+   because writing through the file could evict, and so write
+   back, other sectors first.
+
+   For allocation the disk is divided into groups of
+   GROUP_SECTORS sectors, each with a count of its free sectors.
+   An allocation starts looking at a goal sector, normally next
+   to related data, and moves on group by group, skipping groups
+   with too few free sectors.  Without a usable goal it starts
+   where the previous allocation ended (next fit). */
+
+/* Sectors per allocation group: the sectors described by one
+   sector of the free map file. */
+#define GROUP_SECTORS (BLOCK_SECTOR_SIZE * 8)
+
+/* Location of one sector's worth of the free map file.  OFS is
+   nonzero only if the file is stored inline in its inode. */
+struct map_part
+  {
+    block_sector_t sector;              /* Sector holding the part. */
+    int ofs;                            /* Offset within SECTOR. */
+  };
 
 static struct file *free_map_file;   /* Free map file. */
+static struct map_part *map_parts;   /* Where each of its sectors
+                                        is on disk, once it is open. */
+static uint8_t map_buffer[BLOCK_SECTOR_SIZE]; /* For free_map_flush(). */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty_map;     /* Free map file sectors that
+                                        differ from free_map. */
+static size_t *group_free;           /* Free sectors in each group. */
+static size_t group_cnt;             /* Number of groups. */
+static block_sector_t rover;         /* End of the last allocation. */
+static struct lock free_map_lock;    /* Protects the above. */
+
+static void count_group_free (void);
+static struct map_part *locate_parts (struct file *);
 
 /* Initializes the free map. */
 void
@@ -17,26 +63,155 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("group table allocation failed");
+  count_group_free ();
+  lock_init_named (&free_map_lock, "free_map");
+}
+
+/* Recomputes every group's free count from the free map. */
+static void
+count_group_free (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    {
+      size_t start = g * GROUP_SECTORS;
+      size_t cnt = size - start < GROUP_SECTORS ? size - start : GROUP_SECTORS;
+      group_free[g] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Updates the free counts of the groups that CNT sectors
+   starting at SECTOR belong to, which have just been allocated
+   if ALLOCATED is true or released otherwise. */
+static void
+update_group_free (block_sector_t sector, size_t cnt, bool allocated)
+{
+  while (cnt > 0)
+    {
+      size_t g = sector / GROUP_SECTORS;
+      size_t n = (g + 1) * GROUP_SECTORS - sector;
+      if (n > cnt)
+        n = cnt;
+
+      if (allocated)
+        group_free[g] -= n;
+      else
+        group_free[g] += n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Returns the first sector of the first run of CNT free sectors
+   that lies entirely within sectors START...END - 1, or
+   BITMAP_ERROR if there is none. */
+static size_t
+scan_range (size_t start, size_t end, size_t cnt)
+{
+  size_t run = 0;
+  size_t i;
+
+  if (cnt == 0)
+    return start;
+  for (i = start; i < end; i++)
+    if (bitmap_test (free_map, i))
+      run = 0;
+    else if (++run == cnt)
+      return i + 1 - cnt;
+  return BITMAP_ERROR;
+}
+
+/* Returns the first sector of a run of CNT free sectors, looking
+   first at GOAL, or BITMAP_ERROR if there is none. */
+static size_t
+find_free (block_sector_t goal, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t end, i;
+  size_t sector = BITMAP_ERROR;
+
+  /* From GOAL to the end of its group, then the groups after
+     it that have room, wrapping around to GOAL's group. */
+  if (cnt <= GROUP_SECTORS)
+    for (i = 0; i <= group_cnt && sector == BITMAP_ERROR; i++)
+      {
+        size_t g = (goal / GROUP_SECTORS + i) % group_cnt;
+        size_t start = g * GROUP_SECTORS;
+
+        end = start + GROUP_SECTORS < size ? start + GROUP_SECTORS : size;
+        if (group_free[g] < cnt)
+          continue;
+        if (i == 0)
+          sector = scan_range (goal, end, cnt);
+        else if (i == group_cnt)
+          sector = scan_range (start, goal + cnt - 1 < end
+                                      ? goal + cnt - 1 : end, cnt);
+        else
+          sector = scan_range (start, end, cnt);
+      }
+
+  /* Runs longer than a group, or crossing group boundaries. */
+  if (sector == BITMAP_ERROR)
+    {
+      sector = scan_range (goal, size, cnt);
+      if (sector == BITMAP_ERROR)
+        {
+          end = goal + cnt - 1 < size ? goal + cnt - 1 : size;
+          sector = scan_range (0, end, cnt);
+        }
+    }
+  return sector;
+}
+
+/* Marks the free map file sectors holding the bits for CNT
+   sectors starting at SECTOR as needing to be written. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t bits_per_sector = BLOCK_SECTOR_SIZE * 8;
+  size_t first = sector / bits_per_sector;
+  size_t last = (sector + cnt - 1) / bits_per_sector;
+
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_map, first, last - first + 1, true);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The sectors are placed at or as soon
+   after GOAL as possible; pass FREE_MAP_NO_GOAL to continue from
+   the previous allocation instead.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate (block_sector_t goal, size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t sector;
+
+  lock_acquire (&free_map_lock);
+  if (goal >= bitmap_size (free_map))
+    goal = rover;
+  sector = find_free (goal, cnt);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      update_group_free (sector, cnt, true);
+      mark_dirty (sector, cnt);
+      rover = (sector + cnt) % bitmap_size (free_map);
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
@@ -44,42 +219,119 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  update_group_free (sector, cnt, false);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the dirty sectors of the free map to the free map
+   file on disk, and waits for them to be written.  Does nothing
+   before the file is open. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (map_parts != NULL)
+    for (i = bitmap_scan (dirty_map, 0, 1, true); i != BITMAP_ERROR;
+         i = bitmap_scan (dirty_map, i + 1, 1, true))
+      {
+        size_t size = bitmap_copy_bytes (free_map, i * BLOCK_SECTOR_SIZE,
+                                         map_buffer, BLOCK_SECTOR_SIZE);
+        cache_write_through (map_parts[i].sector, map_buffer,
+                             map_parts[i].ofs, size);
+        bitmap_reset (dirty_map, i);
+      }
+  lock_release (&free_map_lock);
+}
+
+/* Returns the location of each sector's worth of FILE, the free
+   map file, which must be fully allocated. */
+static struct map_part *
+locate_parts (struct file *file)
+{
+  size_t part_cnt = bitmap_size (dirty_map);
+  struct map_part *parts = malloc (part_cnt * sizeof *parts);
+  size_t i;
+
+  if (parts == NULL)
+    PANIC ("can't locate free map");
+  for (i = 0; i < part_cnt; i++)
+    if (!inode_locate (file_get_inode (file), i * BLOCK_SECTOR_SIZE,
+                       &parts[i].sector, &parts[i].ofs))
+      PANIC ("can't locate free map");
+  return parts;
 }
 
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void) 
 {
+  struct map_part *parts;
+
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_map, false);
+  count_group_free ();
+
+  parts = locate_parts (free_map_file);
+  lock_acquire (&free_map_lock);
+  map_parts = parts;
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  free (map_parts);
+  map_parts = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
-   it. */
+   it.
+
+   The file is created sparse, so this first write allocates all
+   of its sectors, which changes the free map as it is being
+   written; the sectors it has already written are marked dirty
+   again for the next flush.  The file goes through the cache
+   this once, so it is flushed before free_map_flush() starts
+   writing it: from then on its cached sectors are never dirty,
+   so no write-back of them waits on the free map. */
 void
 free_map_create (void) 
 {
+  struct map_part *parts;
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  bitmap_set_all (dirty_map, false);
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  cache_flush ();
+
+  parts = locate_parts (file);
+  lock_acquire (&free_map_lock);
+  free_map_file = file;
+  map_parts = parts;
+  lock_release (&free_map_lock);
 }
@@ -1,74 +1,408 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* inode_disk flags. */
+#define INODE_INLINE 0x1                /* Data stored in inline_data. */
+#define INODE_INDEXED 0x2               /* extents[] describe extent
+                                           blocks. */
+
+/* Largest file whose data can be stored in the inode itself. */
+#define INODE_INLINE_MAX 496
+
+/* Number of extents in an inode and in an extent block. */
+#define INODE_EXTENTS 41
+#define BLOCK_EXTENTS 42
+
+/* Sector of a file block that has none (a hole). */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* A run of COUNT file blocks starting at file block BLOCK,
+   stored in consecutive sectors starting at START.
+
+   In an inode with INODE_INDEXED set, its extents instead each
+   describe an extent block: BLOCK is the first file block that
+   the extent block covers, START is its sector and COUNT is the
+   number of extents in it. */
+struct extent
+  {
+    uint32_t block;                     /* First file block. */
+    block_sector_t start;               /* First sector. */
+    uint32_t count;                     /* Number of blocks. */
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Files of up to INODE_INLINE_MAX bytes keep their data in
+   inline_data and have no data sectors; they move to data
+   sectors when they grow beyond that.  Other files map their
+   blocks with extents, sorted by file block.  Blocks that no
+   extent covers are holes, which read as zeros and get a sector
+   when first written.  When the inode runs out of room for
+   extents, they move to an extent block and the inode indexes
+   extent blocks instead, splitting them as they fill up. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t flags;                     /* INODE_* flags. */
+    uint32_t extent_cnt;                /* Number of extents used. */
+    union
+      {
+        uint8_t inline_data[INODE_INLINE_MAX]; /* If INODE_INLINE. */
+        struct extent extents[INODE_EXTENTS];  /* Otherwise. */
+      };
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* Extent block.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    struct extent extents[BLOCK_EXTENTS]; /* Sorted by file block. */
+    uint32_t unused[2];                 /* Not used. */
+  };
+
+/* A sector of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Key of an inode in open_inodes.  Kept apart from the rest of
+   struct inode so that a lookup can build one on the stack. */
+struct inode_key
+  {
+    struct hash_elem elem;              /* Element in open_inodes. */
+    block_sector_t sector;              /* Sector number of disk location. */
+  };
 
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
-    block_sector_t sector;              /* Sector number of disk location. */
+    struct inode_key key;               /* Key in open_inodes. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* Protects data. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Returns true if INODE's data is stored inline. */
+static inline bool
+is_inline (const struct inode *inode)
+{
+  return (inode->data.flags & INODE_INLINE) != 0;
+}
+
+/* Returns the index of the last of the CNT extents in EXTENTS
+   that starts at or before file block BLOCK, or 0 if there is
+   none.  EXTENTS must be sorted by file block. */
+static size_t
+extent_search (const struct extent *extents, size_t cnt, uint32_t block)
+{
+  size_t lo = 0, hi = cnt;
+
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (extents[mid].block <= block)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Reads extent IDX of the extent block in SECTOR into *E.
+   Extent blocks are read one extent at a time, rather than
+   whole, to keep them off the kernel stack. */
+static void
+read_leaf_extent (block_sector_t sector, size_t idx, struct extent *e)
+{
+  cache_read (sector, e,
+              offsetof (struct extent_block, extents) + idx * sizeof *e,
+              sizeof *e);
+}
+
+/* Returns the sector that holds file block BLOCK of DISK, or
+   NO_SECTOR if the block is a hole. */
+static block_sector_t
+extent_lookup (const struct inode_disk *disk, uint32_t block)
+{
+  struct extent leaf_extent;
+  const struct extent *e;
+
+  if (disk->extent_cnt == 0)
+    return NO_SECTOR;
+  e = &disk->extents[extent_search (disk->extents, disk->extent_cnt, block)];
+  if (disk->flags & INODE_INDEXED)
+    {
+      /* Same search as extent_search(), within the extent
+         block. */
+      block_sector_t leaf = e->start;
+      size_t lo = 0, hi = e->count;
+
+      if (hi == 0)
+        return NO_SECTOR;
+      while (hi - lo > 1)
+        {
+          size_t mid = (lo + hi) / 2;
+          read_leaf_extent (leaf, mid, &leaf_extent);
+          if (leaf_extent.block <= block)
+            lo = mid;
+          else
+            hi = mid;
+        }
+      read_leaf_extent (leaf, lo, &leaf_extent);
+      e = &leaf_extent;
+    }
+  if (block >= e->block && block - e->block < e->count)
+    return e->start + (block - e->block);
+  return NO_SECTOR;
+}
+
+/* Records in EXTENTS, which holds *CNT extents and has room for
+   MAX, that file block BLOCK, which must be a hole, is stored in
+   SECTOR.  Extends a neighboring extent if SECTOR continues it.
+   Returns false if a new extent is needed but there is no
+   room. */
+static bool
+extent_add (struct extent *extents, uint32_t *cnt, size_t max,
+            uint32_t block, block_sector_t sector)
+{
+  size_t pos = 0;
+  struct extent *prev, *next;
+  bool joins_prev, joins_next;
+
+  if (*cnt > 0)
+    {
+      pos = extent_search (extents, *cnt, block);
+      if (extents[pos].block <= block)
+        pos++;
+    }
+  prev = pos > 0 ? &extents[pos - 1] : NULL;
+  next = pos < *cnt ? &extents[pos] : NULL;
+  joins_prev = (prev != NULL && prev->block + prev->count == block
+                && prev->start + prev->count == sector);
+  joins_next = (next != NULL && block + 1 == next->block
+                && sector + 1 == next->start);
+
+  if (joins_prev && joins_next)
+    {
+      prev->count += 1 + next->count;
+      memmove (next, next + 1, (*cnt - pos - 1) * sizeof *next);
+      (*cnt)--;
+    }
+  else if (joins_prev)
+    prev->count++;
+  else if (joins_next)
+    {
+      next->block--;
+      next->start--;
+      next->count++;
+    }
+  else
+    {
+      if (*cnt >= max)
+        return false;
+      memmove (extents + pos + 1, extents + pos,
+               (*cnt - pos) * sizeof *extents);
+      extents[pos].block = block;
+      extents[pos].start = sector;
+      extents[pos].count = 1;
+      (*cnt)++;
+    }
+  return true;
+}
+
+/* Records in DISK, the inode in sector INODE_SECTOR, that file
+   block BLOCK, which must be a hole, is stored in SECTOR.
+   Writes the extent blocks that change; the caller must write
+   DISK itself.  Returns false if an extent block cannot be
+   allocated or the extent tree is full. */
+static bool
+extent_insert (struct inode_disk *disk, block_sector_t inode_sector,
+               uint32_t block, block_sector_t sector)
+{
+  struct extent_block *leaves;
+  struct extent *idx;
+  block_sector_t new_sector;
+  bool success = false;
+
+  if (!(disk->flags & INODE_INDEXED)
+      && extent_add (disk->extents, &disk->extent_cnt, INODE_EXTENTS,
+                     block, sector))
+    return true;
+
+  leaves = calloc (2, sizeof *leaves);
+  if (leaves == NULL)
+    return false;
+
+  if (!(disk->flags & INODE_INDEXED))
+    {
+      /* Move the inode's extents into an extent block. */
+      if (!free_map_allocate (inode_sector + 1, 1, &new_sector))
+        goto done;
+      memcpy (leaves[0].extents, disk->extents,
+              disk->extent_cnt * sizeof *disk->extents);
+      cache_write (new_sector, &leaves[0], 0, BLOCK_SECTOR_SIZE);
+      disk->extents[0].block = 0;
+      disk->extents[0].start = new_sector;
+      disk->extents[0].count = disk->extent_cnt;
+      disk->extent_cnt = 1;
+      disk->flags |= INODE_INDEXED;
+    }
+
+  idx = &disk->extents[extent_search (disk->extents, disk->extent_cnt,
+                                      block)];
+  cache_read (idx->start, &leaves[0], 0, BLOCK_SECTOR_SIZE);
+  if (!extent_add (leaves[0].extents, &idx->count, BLOCK_EXTENTS,
+                   block, sector))
+    {
+      /* Split the full extent block in two. */
+      size_t half = BLOCK_EXTENTS / 2;
+
+      if (disk->extent_cnt >= INODE_EXTENTS
+          || !free_map_allocate (idx->start + 1, 1, &new_sector))
+        goto done;
+      memcpy (leaves[1].extents, leaves[0].extents + half,
+              (BLOCK_EXTENTS - half) * sizeof *leaves[1].extents);
+      memset (leaves[0].extents + half, 0,
+              (BLOCK_EXTENTS - half) * sizeof *leaves[0].extents);
+      memmove (idx + 2, idx + 1,
+               (disk->extents + disk->extent_cnt - (idx + 1)) * sizeof *idx);
+      disk->extent_cnt++;
+      idx[0].count = half;
+      idx[1].block = leaves[1].extents[0].block;
+      idx[1].start = new_sector;
+      idx[1].count = BLOCK_EXTENTS - half;
+
+      if (block >= idx[1].block)
+        extent_add (leaves[1].extents, &idx[1].count, BLOCK_EXTENTS,
+                    block, sector);
+      else
+        extent_add (leaves[0].extents, &idx[0].count, BLOCK_EXTENTS,
+                    block, sector);
+      cache_write (new_sector, &leaves[1], 0, BLOCK_SECTOR_SIZE);
+    }
+  cache_write (idx->start, &leaves[0], 0, BLOCK_SECTOR_SIZE);
+  success = true;
+
+ done:
+  free (leaves);
+  return success;
+}
+
+/* Allocates a zeroed sector for file block BLOCK of DISK, the
+   inode in sector INODE_SECTOR, which must be a hole, and
+   returns it, or NO_SECTOR on failure.  The sector goes right
+   after the one holding the previous block if possible, so that
+   files written in order end up contiguous. */
+static block_sector_t
+allocate_block (struct inode_disk *disk, block_sector_t inode_sector,
+                uint32_t block)
+{
+  block_sector_t prev = (block > 0
+                         ? extent_lookup (disk, block - 1)
+                         : NO_SECTOR);
+  block_sector_t goal = prev != NO_SECTOR ? prev + 1 : inode_sector + 1;
+  block_sector_t sector;
+
+  if (!free_map_allocate (goal, 1, &sector))
+    return NO_SECTOR;
+  if (!extent_insert (disk, inode_sector, block, sector))
+    {
+      free_map_release (sector, 1);
+      return NO_SECTOR;
+    }
+  cache_write (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+  return sector;
+}
+
+/* Releases all of DISK's data sectors and extent blocks. */
+static void
+release_blocks (const struct inode_disk *disk)
+{
+  struct extent leaf_extent;
+  size_t i, j;
+
+  if (disk->flags & INODE_INLINE)
+    return;
+  for (i = 0; i < disk->extent_cnt; i++)
+    {
+      const struct extent *e = &disk->extents[i];
+      if (disk->flags & INODE_INDEXED)
+        {
+          for (j = 0; j < e->count; j++)
+            {
+              read_leaf_extent (e->start, j, &leaf_extent);
+              free_map_release (leaf_extent.start, leaf_extent.count);
+            }
+          free_map_release (e->start, 1);
+        }
+      else
+        free_map_release (e->start, e->count);
+    }
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns NO_SECTOR if INODE does not contain data for a byte at
+   offset POS, either because POS is past end of file or because
+   it lies in a hole.  INODE's lock must be held. */
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return extent_lookup (&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
-    return -1;
+    return NO_SECTOR;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode_key, elem)->sector);
+}
+
+/* Returns true if inode A has a lower sector than inode B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode_key, elem)->sector
+          < hash_entry (b, struct inode_key, elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table creation failed");
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data starts out as a hole, so no data sectors
+   are allocated or written until the file is written to.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool
 inode_create (block_sector_t sector, off_t length)
 {
@@ -84,22 +418,12 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      if (length <= INODE_INLINE_MAX)
+        disk_inode->flags = INODE_INLINE;
+      cache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+      success = true;
       free (disk_inode);
     }
   return success;
@@ -111,19 +435,18 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode_key key;
+  struct hash_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, key.elem);
+      inode_reopen (inode);
+      return inode; 
     }
 
   /* Allocate memory. */
@@ -132,12 +455,13 @@ inode_open (block_sector_t sector)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->sector = sector;
+  inode->key.sector = sector;
+  hash_insert (&open_inodes, &inode->key.elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  cache_read (inode->key.sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
   return inode;
 }
 
@@ -154,7 +478,7 @@ inode_reopen (struct inode *inode)
 block_sector_t
 inode_get_inumber (const struct inode *inode)
 {
-  return inode->sector;
+  return inode->key.sector;
 }
 
 /* Closes INODE and writes it to disk.
@@ -171,14 +495,13 @@ inode_close (struct inode *inode)
   if (--inode->open_cnt == 0)
     {
       /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      hash_delete (&open_inodes, &inode->key.elem);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          free_map_release (inode->key.sector, 1);
+          release_blocks (&inode->data);
         }
 
       free (inode); 
@@ -196,18 +519,32 @@ inode_remove (struct inode *inode)
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Also starts reading the following sector in the background. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  block_sector_t next;
+
+  lock_acquire (&inode->lock);
+  if (is_inline (inode))
+    {
+      if (offset >= inode_length (inode))
+        size = 0;
+      else if (size > inode_length (inode) - offset)
+        size = inode_length (inode) - offset;
+      memcpy (buffer, inode->data.inline_data + offset, size);
+      lock_release (&inode->lock);
+      return size;
+    }
+  lock_release (&inode->lock);
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,55 +557,116 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset);
+      lock_release (&inode->lock);
+      if (sector_idx != NO_SECTOR)
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  /* Sequential readers will most likely want the next sector. */
+  if (bytes_read > 0)
+    {
+      lock_acquire (&inode->lock);
+      next = byte_to_sector (inode, ROUND_UP (offset, BLOCK_SECTOR_SIZE));
+      lock_release (&inode->lock);
+      if (next != NO_SECTOR)
+        cache_readahead (next);
+    }
 
   return bytes_read;
 }
 
+/* Extends INODE to LENGTH bytes.  The new part of the file is a
+   hole, except that an inline file that outgrows the inode moves
+   its data to a newly allocated sector.  INODE's lock must be
+   held.  Returns true if successful. */
+static bool
+inode_grow (struct inode *inode, off_t length)
+{
+  struct inode_disk *disk = &inode->data;
+
+  if (is_inline (inode) && length > INODE_INLINE_MAX)
+    {
+      uint8_t *data = malloc (INODE_INLINE_MAX);
+      block_sector_t sector;
+
+      if (data == NULL)
+        return false;
+      memcpy (data, disk->inline_data, INODE_INLINE_MAX);
+      memset (disk->inline_data, 0, INODE_INLINE_MAX);
+      disk->flags &= ~INODE_INLINE;
+      disk->extent_cnt = 0;
+
+      sector = allocate_block (disk, inode->key.sector, 0);
+      if (sector == NO_SECTOR)
+        {
+          memcpy (disk->inline_data, data, INODE_INLINE_MAX);
+          disk->flags |= INODE_INLINE;
+          free (data);
+          return false;
+        }
+      cache_write (sector, data, 0, disk->length);
+      free (data);
+    }
+  disk->length = length;
+  cache_write (inode->key.sector, disk, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if disk space runs out or an error occurs.
+   Writing past end of file extends the file, but only as far as
+   the bytes actually written. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t old_length = -1;
+  off_t end = offset + size;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  lock_acquire (&inode->lock);
+  if (size > 0 && end > inode_length (inode))
+    {
+      old_length = inode_length (inode);
+      if (!inode_grow (inode, end))
+        {
+          lock_release (&inode->lock);
+          return 0;
+        }
+    }
+
+  if (is_inline (inode))
+    {
+      if (offset >= inode_length (inode))
+        size = 0;
+      else if (size > inode_length (inode) - offset)
+        size = inode_length (inode) - offset;
+      memcpy (inode->data.inline_data + offset, buffer, size);
+      cache_write (inode->key.sector, buffer,
+                   offsetof (struct inode_disk, inline_data) + offset, size);
+      lock_release (&inode->lock);
+      return size;
+    }
+  lock_release (&inode->lock);
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -281,38 +679,43 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Give holes a sector on first write. */
+      lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset);
+      if (sector_idx == NO_SECTOR)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          sector_idx = allocate_block (&inode->data, inode->key.sector,
+                                       offset / BLOCK_SECTOR_SIZE);
+          if (sector_idx != NO_SECTOR)
+            cache_write (inode->key.sector, &inode->data, 0,
+                         BLOCK_SECTOR_SIZE);
         }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+      lock_release (&inode->lock);
+      if (sector_idx == NO_SECTOR)
+        break;
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                   chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* If we extended the file but fell short, give back the part
+     we did not write, unless someone has extended it further
+     meanwhile. */
+  if (old_length >= 0 && offset < end)
+    {
+      lock_acquire (&inode->lock);
+      if (inode->data.length == end)
+        {
+          inode->data.length = offset > old_length ? offset : old_length;
+          cache_write (inode->key.sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+        }
+      lock_release (&inode->lock);
+    }
 
   return bytes_written;
 }
@@ -343,3 +746,32 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Stores into *SECTORP the sector that holds byte offset POS
+   within INODE, and into *OFSP the offset of that byte within
+   the sector.  Returns false if POS is past end of file or lies
+   in a hole. */
+bool
+inode_locate (struct inode *inode, off_t pos, block_sector_t *sectorp,
+              int *ofsp)
+{
+  bool found;
+
+  lock_acquire (&inode->lock);
+  if (pos >= inode_length (inode))
+    found = false;
+  else if (is_inline (inode))
+    {
+      *sectorp = inode->key.sector;
+      *ofsp = offsetof (struct inode_disk, inline_data) + pos;
+      found = true;
+    }
+  else
+    {
+      *sectorp = byte_to_sector (inode, pos);
+      *ofsp = pos % BLOCK_SECTOR_SIZE;
+      found = *sectorp != NO_SECTOR;
+    }
+  lock_release (&inode->lock);
+  return found;
+}
@@ -19,5 +19,6 @@ off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_locate (struct inode *, off_t, block_sector_t *, int *ofs);
 
 #endif /* filesys/inode.h */
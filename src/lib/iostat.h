@@ -0,0 +1,38 @@
+#ifndef __LIB_IOSTAT_H
+#define __LIB_IOSTAT_H
+
+/* Block devices whose statistics iostat() reports, by role.
+   These have the same values as the roles in enum block_type. */
+#define IOSTAT_KERNEL 0         /* Pintos OS kernel. */
+#define IOSTAT_FILESYS 1        /* File system. */
+#define IOSTAT_SCRATCH 2        /* Scratch. */
+#define IOSTAT_SWAP 3           /* Swap. */
+
+/* Number of latency histogram buckets. */
+#define IOSTAT_BUCKETS 40
+
+/* I/O statistics for a block device, as reported by iostat().
+   Times are in CPU time-stamp counter cycles.  A request is one
+   transfer asked of the block layer; a command is one transfer
+   handed to the driver, which may serve several adjacent
+   requests. */
+struct iostat
+  {
+    unsigned long long read_bytes;      /* Bytes read. */
+    unsigned long long write_bytes;     /* Bytes written. */
+    unsigned long long read_requests;   /* Read requests. */
+    unsigned long long write_requests;  /* Write requests. */
+    unsigned long long commands;        /* Commands issued. */
+    unsigned long long sequential;      /* Requests that started where
+                                           the previous one ended. */
+    unsigned long long random;          /* Other requests. */
+    unsigned long long latency[IOSTAT_BUCKETS]; /* Requests by
+                                           floor(log2(cycles from
+                                           submission to completion)). */
+    unsigned long long max_latency;     /* Longest request. */
+    unsigned long long busy_tsc;        /* Time with requests pending. */
+    unsigned max_pending;               /* Most requests pending at
+                                           once. */
+  };
+
+#endif /* lib/iostat.h */
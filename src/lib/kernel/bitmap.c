@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -358,6 +359,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Copies up to SIZE bytes of B's on-disk form, as written by
+   bitmap_write(), starting at byte offset OFS, into DST.
+   Returns the number of bytes copied, which is less than SIZE
+   if the range runs past the end of B. */
+size_t
+bitmap_copy_bytes (const struct bitmap *b, size_t ofs, void *dst, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+
+  if (ofs >= file_size)
+    return 0;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  memcpy (dst, (const uint8_t *) b->bits + ofs, size);
+  return size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
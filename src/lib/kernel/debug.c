@@ -7,6 +7,7 @@
 #include <string.h>
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/sched-trace.h"
 #include "threads/thread.h"
 #include "threads/switch.h"
 #include "threads/vaddr.h"
@@ -36,6 +37,7 @@ debug_panic (const char *file, int line, const char *function,
       va_end (args);
 
       debug_backtrace ();
+      sched_trace_dump ();
     }
   else if (level == 2)
     printf ("Kernel PANIC recursion at %s:%d in %s().\n",
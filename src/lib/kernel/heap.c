@@ -0,0 +1,194 @@
+#include "heap.h"
+#include "../debug.h"
+
+static struct heap_elem *link (struct heap *,
+                               struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+
+/* Initializes HEAP as an empty heap ordered by LESS, given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *heap, heap_less_func *less, void *aux) 
+{
+  ASSERT (heap != NULL);
+  ASSERT (less != NULL);
+
+  heap->root = NULL;
+  heap->elem_cnt = 0;
+  heap->less = less;
+  heap->aux = aux;
+}
+
+/* Inserts ELEM into HEAP. */
+void
+heap_push (struct heap *heap, struct heap_elem *elem) 
+{
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+
+  elem->child = elem->next = elem->prev = NULL;
+  heap->root = heap->root != NULL ? link (heap, heap->root, elem) : elem;
+  heap->elem_cnt++;
+}
+
+/* Removes and returns the maximum element of HEAP, which must
+   not be empty. */
+struct heap_elem *
+heap_pop (struct heap *heap) 
+{
+  struct heap_elem *top;
+
+  ASSERT (heap != NULL);
+  ASSERT (!heap_empty (heap));
+
+  top = heap->root;
+  heap->root = merge_pairs (heap, top->child);
+  heap->elem_cnt--;
+  top->child = NULL;
+  return top;
+}
+
+/* Removes ELEM, which must be in HEAP, from HEAP. */
+void
+heap_remove (struct heap *heap, struct heap_elem *elem) 
+{
+  struct heap_elem *subtree;
+
+  ASSERT (heap != NULL);
+  ASSERT (elem != NULL);
+
+  if (elem == heap->root)
+    {
+      heap_pop (heap);
+      return;
+    }
+
+  /* Unlink ELEM from its parent's list of children. */
+  ASSERT (elem->prev != NULL);
+  if (elem->prev->child == elem)
+    elem->prev->child = elem->next;
+  else
+    elem->prev->next = elem->next;
+  if (elem->next != NULL)
+    elem->next->prev = elem->prev;
+  elem->next = elem->prev = NULL;
+
+  /* Merge ELEM's children back into the heap. */
+  subtree = merge_pairs (heap, elem->child);
+  if (subtree != NULL)
+    heap->root = link (heap, heap->root, subtree);
+  elem->child = NULL;
+  heap->elem_cnt--;
+}
+
+/* Restores heap order after the value of ELEM, which must be in
+   HEAP, has changed in either direction. */
+void
+heap_update (struct heap *heap, struct heap_elem *elem) 
+{
+  heap_remove (heap, elem);
+  heap_push (heap, elem);
+}
+
+/* Returns the maximum element of HEAP, or a null pointer if HEAP
+   is empty. */
+struct heap_elem *
+heap_top (const struct heap *heap) 
+{
+  ASSERT (heap != NULL);
+
+  return heap->root;
+}
+
+/* Returns the number of elements in HEAP. */
+size_t
+heap_size (const struct heap *heap) 
+{
+  ASSERT (heap != NULL);
+
+  return heap->elem_cnt;
+}
+
+/* Returns true if HEAP contains no elements, false otherwise. */
+bool
+heap_empty (const struct heap *heap) 
+{
+  ASSERT (heap != NULL);
+
+  return heap->root == NULL;
+}
+
+/* Combines the trees rooted at A and B, neither of which may
+   have siblings, into one, and returns its root. */
+static struct heap_elem *
+link (struct heap *heap, struct heap_elem *a, struct heap_elem *b) 
+{
+  struct heap_elem *parent, *child;
+
+  if (heap->less (a, b, heap->aux))
+    {
+      parent = b;
+      child = a;
+    }
+  else
+    {
+      parent = a;
+      child = b;
+    }
+
+  child->prev = parent;
+  child->next = parent->child;
+  if (parent->child != NULL)
+    parent->child->prev = child;
+  parent->child = child;
+  return parent;
+}
+
+/* Combines FIRST and all of its later siblings into a single
+   tree and returns its root, or a null pointer if FIRST is null.
+   Uses the standard two-pass scheme: link siblings in pairs from
+   left to right, then link the results from right to left. */
+static struct heap_elem *
+merge_pairs (struct heap *heap, struct heap_elem *first) 
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root;
+
+  /* First pass.  PAIRS is a stack of linked pairs, chained
+     through their `next' members, most recent first. */
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+
+      if (b != NULL)
+        {
+          first = b->next;
+          a->next = a->prev = b->next = b->prev = NULL;
+          a = link (heap, a, b);
+        }
+      else
+        {
+          first = NULL;
+          a->prev = NULL;
+        }
+      a->next = pairs;
+      pairs = a;
+    }
+  if (pairs == NULL)
+    return NULL;
+
+  /* Second pass. */
+  root = pairs;
+  pairs = pairs->next;
+  root->next = NULL;
+  while (pairs != NULL)
+    {
+      struct heap_elem *next = pairs->next;
+      pairs->next = NULL;
+      root = link (heap, root, pairs);
+      pairs = next;
+    }
+  root->prev = NULL;
+  return root;
+}
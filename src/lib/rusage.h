@@ -0,0 +1,20 @@
+#ifndef __LIB_RUSAGE_H
+#define __LIB_RUSAGE_H
+
+/* Whose resource usage getrusage() reports. */
+#define RUSAGE_SELF 0           /* The calling process. */
+#define RUSAGE_CHILDREN (-1)    /* Its exited children, recursively. */
+
+/* Resource usage of a process, as reported by getrusage().
+   Times are in timer ticks, of which there are TIMER_FREQ (by
+   default 100) per second. */
+struct rusage
+  {
+    long long user_ticks;       /* Ticks spent running user code. */
+    long long kernel_ticks;     /* Ticks spent in the kernel. */
+    unsigned voluntary_switches;   /* Gave up the CPU by blocking. */
+    unsigned involuntary_switches; /* Switched out while runnable. */
+    unsigned page_faults;       /* Page faults taken. */
+  };
+
+#endif /* lib/rusage.h */
@@ -182,3 +182,15 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+getrusage (int who, struct rusage *usage)
+{
+  return syscall2 (SYS_GETRUSAGE, who, usage);
+}
+
+bool
+iostat (int role, struct iostat *stats)
+{
+  return syscall2 (SYS_IOSTAT, role, stats);
+}
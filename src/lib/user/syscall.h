@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <rusage.h>
+#include <iostat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +47,8 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool getrusage (int who, struct rusage *);
+bool iostat (int role, struct iostat *);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,38 @@
+/* Creates several hundred files in the root directory, more
+   than fit in one directory bucket, then looks each one up. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 300
+
+void
+test_main (void) 
+{
+  char name[16];
+  int fd;
+  int i;
+
+  msg ("creating file0 through file%d...", FILE_CNT - 1);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      CHECK (create (name, 0), "create \"%s\"", name);
+    }
+  quiet = false;
+
+  msg ("opening file0 through file%d...", FILE_CNT - 1);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      close (fd);
+    }
+  quiet = false;
+
+  CHECK (open ("file") == -1, "open \"file\" (must fail)");
+}
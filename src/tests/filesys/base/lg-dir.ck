@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-dir) begin
+(lg-dir) creating file0 through file299...
+(lg-dir) opening file0 through file299...
+(lg-dir) open "file" (must fail)
+(lg-dir) end
+EOF
+pass;
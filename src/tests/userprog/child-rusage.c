@@ -0,0 +1,27 @@
+/* Child process run by the rusage-normal test.
+   Spins until it has been charged a user tick. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+
+int
+main (void) 
+{
+  struct rusage usage;
+  int i;
+
+  test_name = "child-rusage";
+
+  msg ("run");
+  for (i = 0; i < 1000; i++)
+    {
+      volatile int j;
+      for (j = 0; j < 100000; j++)
+        continue;
+      if (!getrusage (RUSAGE_SELF, &usage))
+        fail ("getrusage (RUSAGE_SELF) failed");
+      if (usage.user_ticks > 0)
+        return 0;
+    }
+  fail ("no user tick charged");
+}
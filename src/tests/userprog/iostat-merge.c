@@ -0,0 +1,63 @@
+/* Writes a file whose sectors are adjacent on disk and waits for
+   the buffer cache's write-behind to flush it.  Checks that the
+   block layer merged the flushed sectors, i.e. that the file
+   system device saw fewer commands than requests. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Fits in the buffer cache, so that only the flush writes it. */
+static char buf[16 * 1024];
+
+/* Returns the CPU time charged to this process so far, in timer
+   ticks. */
+static long long
+cpu_ticks (void)
+{
+  struct rusage usage;
+
+  if (!getrusage (RUSAGE_SELF, &usage))
+    fail ("getrusage (RUSAGE_SELF) failed");
+  return usage.user_ticks + usage.kernel_ticks;
+}
+
+void
+test_main (void) 
+{
+  struct iostat before, after;
+  unsigned long long requests, commands;
+  long long start;
+  int fd;
+
+  CHECK (iostat (IOSTAT_FILESYS, &before), "iostat (IOSTAT_FILESYS)");
+  CHECK (create ("merge", 0), "create \"merge\"");
+  CHECK ((fd = open ("merge")) > 1, "open \"merge\"");
+  memset (buf, 'm', sizeof buf);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write %zu bytes to \"merge\"", sizeof buf);
+  msg ("close \"merge\"");
+  close (fd);
+
+  /* Spin, since we are the only process, so that CPU time is
+     wall time, until the file's sectors have been written or
+     some 10 seconds have passed. */
+  msg ("wait for write-behind");
+  start = cpu_ticks ();
+  do
+    {
+      if (!iostat (IOSTAT_FILESYS, &after))
+        fail ("iostat (IOSTAT_FILESYS) failed");
+      if ((after.write_bytes - before.write_bytes) >= sizeof buf)
+        break;
+    }
+  while (cpu_ticks () - start < 1000);
+  CHECK (after.write_bytes - before.write_bytes >= sizeof buf,
+         "file written back");
+
+  requests = (after.read_requests + after.write_requests
+              - before.read_requests - before.write_requests);
+  commands = after.commands - before.commands;
+  CHECK (commands < requests, "fewer commands than requests");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(iostat-merge) begin
+(iostat-merge) iostat (IOSTAT_FILESYS)
+(iostat-merge) create "merge"
+(iostat-merge) open "merge"
+(iostat-merge) write 16384 bytes to "merge"
+(iostat-merge) close "merge"
+(iostat-merge) wait for write-behind
+(iostat-merge) file written back
+(iostat-merge) fewer commands than requests
+(iostat-merge) end
+iostat-merge: exit(0)
+EOF
+pass;
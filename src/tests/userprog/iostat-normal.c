@@ -0,0 +1,50 @@
+/* Checks that iostat() counts the file system device's bytes
+   and requests.  Writes and reads back a file larger than the
+   buffer cache, so that both have to reach the disk. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[4096];
+
+/* Bigger than the buffer cache. */
+#define FILE_SIZE (64 * 1024)
+
+void
+test_main (void) 
+{
+  struct iostat before, after;
+  int fd;
+  int i;
+
+  CHECK (iostat (IOSTAT_FILESYS, &before), "iostat (IOSTAT_FILESYS)");
+
+  CHECK (create ("iostat", 0), "create \"iostat\"");
+  CHECK ((fd = open ("iostat")) > 1, "open \"iostat\"");
+  msg ("write %d bytes", FILE_SIZE);
+  memset (buf, 'x', sizeof buf);
+  for (i = 0; i < FILE_SIZE; i += sizeof buf)
+    if (write (fd, buf, sizeof buf) != sizeof buf)
+      fail ("write at offset %d failed", i);
+  msg ("read %d bytes", FILE_SIZE);
+  seek (fd, 0);
+  for (i = 0; i < FILE_SIZE; i += sizeof buf)
+    if (read (fd, buf, sizeof buf) != sizeof buf)
+      fail ("read at offset %d failed", i);
+  msg ("close \"iostat\"");
+  close (fd);
+
+  CHECK (iostat (IOSTAT_FILESYS, &after), "iostat (IOSTAT_FILESYS)");
+  CHECK (after.write_bytes > before.write_bytes, "bytes written grew");
+  CHECK (after.write_requests > before.write_requests,
+         "write requests grew");
+  CHECK (after.read_bytes > before.read_bytes, "bytes read grew");
+  CHECK (after.read_requests > before.read_requests, "read requests grew");
+  CHECK (after.sequential + after.random
+         == after.read_requests + after.write_requests,
+         "every request is sequential or random");
+
+  CHECK (!iostat (42, &after), "iostat (42) (must fail)");
+}
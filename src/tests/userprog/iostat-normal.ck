@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(iostat-normal) begin
+(iostat-normal) iostat (IOSTAT_FILESYS)
+(iostat-normal) create "iostat"
+(iostat-normal) open "iostat"
+(iostat-normal) write 65536 bytes
+(iostat-normal) read 65536 bytes
+(iostat-normal) close "iostat"
+(iostat-normal) iostat (IOSTAT_FILESYS)
+(iostat-normal) bytes written grew
+(iostat-normal) write requests grew
+(iostat-normal) bytes read grew
+(iostat-normal) read requests grew
+(iostat-normal) every request is sequential or random
+(iostat-normal) iostat (42) (must fail)
+(iostat-normal) end
+iostat-normal: exit(0)
+EOF
+pass;
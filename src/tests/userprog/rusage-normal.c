@@ -0,0 +1,39 @@
+/* Checks that getrusage() charges CPU time to the calling
+   process, counts its context switches, and reports the usage
+   of its exited children. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct rusage before, after, children;
+  int i;
+
+  CHECK (getrusage (RUSAGE_SELF, &before), "getrusage (RUSAGE_SELF)");
+
+  msg ("spin until a user tick is charged");
+  for (i = 0; i < 1000; i++)
+    {
+      volatile int j;
+      for (j = 0; j < 100000; j++)
+        continue;
+      if (!getrusage (RUSAGE_SELF, &after))
+        fail ("getrusage (RUSAGE_SELF) failed");
+      if (after.user_ticks > before.user_ticks)
+        break;
+    }
+  CHECK (after.user_ticks > before.user_ticks, "user ticks grew");
+
+  msg ("wait(exec()) = %d", wait (exec ("child-rusage")));
+  CHECK (getrusage (RUSAGE_SELF, &after), "getrusage (RUSAGE_SELF)");
+  CHECK (after.voluntary_switches > before.voluntary_switches,
+         "voluntary switches grew");
+  CHECK (getrusage (RUSAGE_CHILDREN, &children),
+         "getrusage (RUSAGE_CHILDREN)");
+  CHECK (children.user_ticks > 0, "children's user ticks counted");
+
+  CHECK (!getrusage (42, &children), "getrusage (42) (must fail)");
+}
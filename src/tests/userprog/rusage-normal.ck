@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rusage-normal) begin
+(rusage-normal) getrusage (RUSAGE_SELF)
+(rusage-normal) spin until a user tick is charged
+(rusage-normal) user ticks grew
+(child-rusage) run
+child-rusage: exit(0)
+(rusage-normal) wait(exec()) = 0
+(rusage-normal) getrusage (RUSAGE_SELF)
+(rusage-normal) voluntary switches grew
+(rusage-normal) getrusage (RUSAGE_CHILDREN)
+(rusage-normal) children's user ticks counted
+(rusage-normal) getrusage (42) (must fail)
+(rusage-normal) end
+rusage-normal: exit(0)
+EOF
+pass;
@@ -21,6 +21,7 @@
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/sched-trace.h"
 #include "threads/thread.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
@@ -36,6 +37,8 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -54,6 +57,10 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Size in kB of the RAM disk to create for each role,
+   or 0 for none. */
+static size_t ramdisk_kb[BLOCK_ROLE_CNT];
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -70,6 +77,7 @@ static void usage (void);
 #ifdef FILESYS
 static void locate_block_devices (void);
 static void locate_block_device (enum block_type, const char *name);
+static void parse_ramdisk_option (char *value);
 #endif
 
 int main (void) NO_RETURN;
@@ -79,6 +87,9 @@ int
 main (void)
 {
   char **argv;
+#ifdef FILESYS
+  int i;
+#endif
 
   /* Clear BSS. */  
   bss_init ();
@@ -124,7 +135,11 @@ main (void)
 
 #ifdef FILESYS
   /* Initialize file system. */
+  for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    if (ramdisk_kb[i] != 0)
+      ramdisk_init (i, ramdisk_kb[i]);
   ide_init ();
+  virtio_blk_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -251,6 +266,8 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        parse_ramdisk_option (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -260,6 +277,10 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-sched-trace"))
+        sched_trace_enabled = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -380,9 +401,13 @@ usage (void)
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
+          "  -ramdisk=ROLE:KB   Use a KB kB RAM disk for ROLE by default.\n"
+          "                     ROLE is `scratch' or `swap'.\n"
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the periodic timer tick while idle.\n"
+          "  -sched-trace       Trace scheduler events, dump at shutdown.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -391,6 +416,26 @@ usage (void)
 }
 
 #ifdef FILESYS
+/* Parses VALUE, the argument to -ramdisk, which has the form
+   ROLE:KB. */
+static void
+parse_ramdisk_option (char *value)
+{
+  char *save_ptr;
+  char *role = value != NULL ? strtok_r (value, ":", &save_ptr) : NULL;
+  char *kb = role != NULL ? strtok_r (NULL, "", &save_ptr) : NULL;
+  int size;
+
+  if (kb == NULL || (size = atoi (kb)) <= 0)
+    PANIC ("-ramdisk requires an argument of the form ROLE:KB");
+  if (!strcmp (role, "scratch"))
+    ramdisk_kb[BLOCK_SCRATCH] = size;
+  else if (!strcmp (role, "swap"))
+    ramdisk_kb[BLOCK_SWAP] = size;
+  else
+    PANIC ("-ramdisk: unknown role `%s'", role);
+}
+
 /* Figure out what block devices to cast in the various Pintos roles. */
 static void
 locate_block_devices (void)
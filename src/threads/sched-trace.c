@@ -0,0 +1,95 @@
+#include "threads/sched-trace.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Scheduler event trace.
+
+   When enabled, the scheduler records context switches, wakeups,
+   priority donations and sleeps into a fixed-size ring buffer,
+   overwriting the oldest events once it fills up.  At shutdown,
+   or on a kernel panic, the buffer is printed one event per line
+   prefixed by "sched-trace:", which utils/sched-timeline turns
+   into a per-thread timeline. */
+
+/* Number of events kept.  Must be a power of 2. */
+#define SCHED_TRACE_SIZE 2048
+
+/* One recorded event. */
+struct sched_event
+  {
+    uint64_t tsc;               /* TSC when recorded. */
+    int64_t arg;                /* Type-specific argument. */
+    int a, b;                   /* Thread ids involved. */
+    enum sched_event_type type; /* Event kind. */
+  };
+
+bool sched_trace_enabled;
+
+static struct sched_event events[SCHED_TRACE_SIZE];
+static uint64_t event_cnt;      /* Events recorded since boot. */
+
+static const char *type_names[] = { "switch", "wakeup", "donate", "sleep" };
+
+/* Records an event of the given TYPE involving threads A and B.
+   May be called from an interrupt handler. */
+void
+sched_trace_record (enum sched_event_type type, int a, int b, int64_t arg)
+{
+  enum intr_level old_level;
+  struct sched_event *e;
+
+  if (!sched_trace_enabled)
+    return;
+
+  old_level = intr_disable ();
+  e = &events[event_cnt++ & (SCHED_TRACE_SIZE - 1)];
+  e->tsc = timer_rdtsc ();
+  e->type = type;
+  e->a = a;
+  e->b = b;
+  e->arg = arg;
+  intr_set_level (old_level);
+}
+
+/* Prints T's tid and name for sched_trace_dump(). */
+static void
+print_thread (struct thread *t, void *aux UNUSED)
+{
+  printf ("sched-trace: thread %d %s\n", t->tid, t->name);
+}
+
+/* Prints the recorded events, oldest first, and stops tracing.
+   Timestamps are in nanoseconds since boot. */
+void
+sched_trace_dump (void)
+{
+  enum intr_level old_level;
+  uint64_t first, i;
+  uint64_t now_tsc;
+  int64_t now_ns;
+
+  if (!sched_trace_enabled)
+    return;
+
+  old_level = intr_disable ();
+  sched_trace_enabled = false;
+  now_tsc = timer_rdtsc ();
+  now_ns = timer_now_ns ();
+
+  first = event_cnt > SCHED_TRACE_SIZE ? event_cnt - SCHED_TRACE_SIZE : 0;
+  printf ("sched-trace: begin %"PRIu64" events, %"PRIu64" dropped\n",
+          event_cnt - first, first);
+  thread_foreach (print_thread, NULL);
+  for (i = first; i < event_cnt; i++)
+    {
+      const struct sched_event *e = &events[i & (SCHED_TRACE_SIZE - 1)];
+      printf ("sched-trace: %"PRId64" %s %d %d %"PRId64"\n",
+              now_ns - timer_tsc_to_ns (now_tsc - e->tsc),
+              type_names[e->type], e->a, e->b, e->arg);
+    }
+  printf ("sched-trace: end\n");
+  intr_set_level (old_level);
+}
@@ -0,0 +1,23 @@
+#ifndef THREADS_SCHED_TRACE_H
+#define THREADS_SCHED_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Kinds of scheduler events recorded in the trace. */
+enum sched_event_type
+  {
+    SCHED_EV_SWITCH,            /* Context switch: A -> B, ARG = A's status. */
+    SCHED_EV_WAKEUP,            /* A unblocked while B ran, ARG = priority. */
+    SCHED_EV_DONATE,            /* A donated to B, ARG = new priority. */
+    SCHED_EV_SLEEP              /* A sleeps, ARG = wakeup tick. */
+  };
+
+/* If false (default), no events are recorded.
+   If true, set by kernel command-line option "-sched-trace". */
+extern bool sched_trace_enabled;
+
+void sched_trace_record (enum sched_event_type, int a, int b, int64_t arg);
+void sched_trace_dump (void);
+
+#endif /* threads/sched-trace.h */
@@ -27,10 +27,22 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
+
+/* List of locks initialized with lock_init_named(), for
+   lock_print_stats(). */
+static struct list named_locks = LIST_INITIALIZER (named_locks);
+
+/* Arrival counter for waiters, used to keep waiters of equal
+   priority in FIFO order. */
+static unsigned waiter_seq;
+
+static bool seq_before (unsigned a, unsigned b);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -47,7 +59,7 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  heap_init (&sema->waiters, compare_thread_waiter_priority, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -68,7 +80,19 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_insert_ordered(&sema->waiters, &thread_current ()->elem, compare_thread_prority, NULL);
+      struct thread *cur = thread_current ();
+
+      cur->waiter_seq = waiter_seq++;
+      heap_push (&sema->waiters, &cur->waiter_elem);
+
+      /* A thread waiting in cond_wait() is ordered by its place
+         in the condition's waiters, not in this private
+         semaphore's. */
+      if (cur->waiting_heap == NULL)
+        {
+          cur->waiting_heap = &sema->waiters;
+          cur->waiting_elem = &cur->waiter_elem;
+        }
       thread_block ();
     }
   sema->value--;
@@ -113,10 +137,12 @@ sema_up (struct semaphore *sema)
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters)) {
-    list_sort(&sema->waiters, compare_thread_prority, NULL);
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+  if (!heap_empty (&sema->waiters)) {
+    struct thread *t = heap_entry (heap_pop (&sema->waiters),
+                                   struct thread, waiter_elem);
+    if (t->waiting_heap == &sema->waiters)
+      t->waiting_heap = NULL;
+    thread_unblock (t);
   }
   sema->value++;
   thread_preemption(); //
@@ -182,6 +208,60 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  heap_init (&lock->donors, compare_thread_donator_priority, NULL);
+  lock->max_priority = PRI_MIN - 1;
+  lock->name = NULL;
+}
+
+/* Initializes LOCK like lock_init(), but also gives it NAME and
+   keeps contention statistics for it, which lock_print_stats()
+   reports at shutdown.  NAME and LOCK must remain valid as long
+   as Pintos runs, so this is meant for long-lived locks. */
+void
+lock_init_named (struct lock *lock, const char *name)
+{
+  enum intr_level old_level;
+
+  ASSERT (name != NULL);
+
+  lock_init (lock);
+  lock->name = name;
+  memset (&lock->stats, 0, sizeof lock->stats);
+
+  old_level = intr_disable ();
+  list_push_back (&named_locks, &lock->named_elem);
+  intr_set_level (old_level);
+}
+
+/* Makes CUR the holder of LOCK, which it has just acquired. */
+static void
+lock_set_holder (struct lock *lock, struct thread *cur)
+{
+  enum intr_level old_level = intr_disable ();
+  struct heap_elem *top;
+
+  if (cur->waiting_lock != NULL)
+    {
+      heap_remove (&lock->donors, &cur->donor_elem);
+      cur->waiting_lock = NULL;
+    }
+  lock->holder = cur;
+
+  /* Threads still waiting for LOCK now donate to CUR. */
+  top = heap_top (&lock->donors);
+  lock->max_priority = (top != NULL
+                        ? heap_entry (top, struct thread, donor_elem)->priority
+                        : PRI_MIN - 1);
+  heap_push (&cur->held_locks, &lock->held_elem);
+  if (!thread_mlfqs)
+    update_priority ();
+  intr_set_level (old_level);
+
+  if (lock->name != NULL)
+    {
+      lock->stats.acquire_cnt++;
+      lock->stats.acquired_tsc = timer_rdtsc ();
+    }
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -200,18 +280,25 @@ lock_acquire (struct lock *lock)
   ASSERT (!lock_held_by_current_thread (lock));
 
   struct thread *cur = thread_current();
+  enum intr_level old_level = intr_disable ();
+  bool contended = lock->holder != NULL;
+  uint64_t wait_start = lock->name != NULL ? timer_rdtsc () : 0;
 
   if (!thread_mlfqs){
     if (lock->holder){
       cur->waiting_lock = lock;        
-      list_insert_ordered(&lock->holder->donations_list, &cur->donator, compare_thread_donator_priority, NULL);
-      nested_donation(cur->waiting_lock, cur);
+      nested_donation(lock, cur);
     }
   }
+  intr_set_level (old_level);
 
   sema_down (&lock->semaphore);
-  cur->waiting_lock = NULL;
-  lock->holder = cur;
+  lock_set_holder (lock, cur);
+  if (lock->name != NULL && contended)
+    {
+      lock->stats.contended_cnt++;
+      lock->stats.wait_tsc += lock->stats.acquired_tsc - wait_start;
+    }
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -230,7 +317,7 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    lock_set_holder (lock, thread_current ());
   return success;
 }
 
@@ -245,18 +332,25 @@ lock_release (struct lock *lock)
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
-  struct list_elem *e;
   struct thread *cur = thread_current();
+  enum intr_level old_level;
+
+  if (lock->name != NULL)
+    {
+      uint64_t held = timer_rdtsc () - lock->stats.acquired_tsc;
+      if (held > lock->stats.max_hold_tsc)
+        lock->stats.max_hold_tsc = held;
+    }
+
+  old_level = intr_disable ();
   
-  if (!thread_mlfqs){
-    for (e = list_begin (&cur->donations_list); e != list_end (&cur->donations_list); e = list_next (e)){
-      if (list_entry(e, struct thread, donator)->waiting_lock == lock)
-        list_remove(e);
-    }  
+  /* Dropping LOCK drops every donation made through it. */
+  heap_remove (&cur->held_locks, &lock->held_elem);
+  if (!thread_mlfqs)
     update_priority();
-  }
   
   lock->holder = NULL;
+  intr_set_level (old_level);
   sema_up (&lock->semaphore);
 }
 
@@ -271,11 +365,33 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
+/* Prints contention statistics for every named lock. */
+void
+lock_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&named_locks); e != list_end (&named_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, named_elem);
+      const struct lock_stats *s = &lock->stats;
+
+      printf ("Lock %s: %u acquires, %u contended, "
+              "%"PRId64" us waiting, %"PRId64" us max hold\n",
+              lock->name, s->acquire_cnt, s->contended_cnt,
+              timer_tsc_to_ns (s->wait_tsc) / 1000,
+              timer_tsc_to_ns (s->max_hold_tsc) / 1000);
+    }
+}
+
+/* One semaphore in a condition's waiters. */
 struct semaphore_elem 
   {
-    struct list_elem elem;              /* List element. */
+    struct heap_elem elem;              /* Heap element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
+    unsigned seq;                       /* FIFO tiebreak. */
   };
 
 /* Initializes condition variable COND.  A condition variable
@@ -286,7 +402,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  heap_init (&cond->waiters, compare_semaphore_priority, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -313,6 +429,8 @@ void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
   struct semaphore_elem waiter;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
@@ -320,7 +438,15 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
-  list_insert_ordered(&cond->waiters, &waiter.elem, compare_semaphore_priority, NULL); //
+  waiter.thread = cur;
+
+  old_level = intr_disable ();
+  waiter.seq = waiter_seq++;
+  heap_push (&cond->waiters, &waiter.elem);
+  cur->waiting_heap = &cond->waiters;
+  cur->waiting_elem = &waiter.elem;
+  intr_set_level (old_level);
+
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
@@ -341,10 +467,14 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters)) {
-    list_sort(&cond->waiters, compare_semaphore_priority, NULL);
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+  if (!heap_empty (&cond->waiters)) {
+    enum intr_level old_level = intr_disable ();
+    struct semaphore_elem *waiter = heap_entry (heap_pop (&cond->waiters),
+                                                struct semaphore_elem, elem);
+    if (waiter->thread->waiting_heap == &cond->waiters)
+      waiter->thread->waiting_heap = NULL;
+    intr_set_level (old_level);
+    sema_up (&waiter->semaphore);
   }
 }
 
@@ -360,14 +490,47 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!heap_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
 
+/* Orders locks by ascending max_priority. */
+bool
+compare_lock_priority (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED)
+{
+  return heap_entry (a, struct lock, held_elem)->max_priority < heap_entry (b, struct lock, held_elem)->max_priority;
+}
+
+/* Orders threads waiting on a semaphore by ascending priority,
+   and later arrivals below earlier ones of equal priority. */
+bool
+compare_thread_waiter_priority (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED)
+{
+  const struct thread *thread_a = heap_entry (a, struct thread, waiter_elem);
+  const struct thread *thread_b = heap_entry (b, struct thread, waiter_elem);
+
+  if (thread_a->priority != thread_b->priority)
+    return thread_a->priority < thread_b->priority;
+  return seq_before (thread_b->waiter_seq, thread_a->waiter_seq);
+}
+
+/* Orders a condition's waiters the same way, by the priority of
+   the thread waiting on each semaphore. */
 bool
-compare_semaphore_priority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-  struct list waiters_a = list_entry(a, struct semaphore_elem, elem)->semaphore.waiters;
-  struct list waiters_b = list_entry(b, struct semaphore_elem, elem)->semaphore.waiters;
+compare_semaphore_priority (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED)
+{
+  const struct semaphore_elem *waiter_a = heap_entry (a, struct semaphore_elem, elem);
+  const struct semaphore_elem *waiter_b = heap_entry (b, struct semaphore_elem, elem);
+
+  if (waiter_a->thread->priority != waiter_b->thread->priority)
+    return waiter_a->thread->priority < waiter_b->thread->priority;
+  return seq_before (waiter_b->seq, waiter_a->seq);
+}
 
-  return list_entry(list_begin(&waiters_a), struct thread, elem)->priority > list_entry(list_begin(&waiters_b), struct thread, elem)->priority;
+/* Returns true if waiter sequence number A was handed out before
+   B, allowing for wraparound. */
+static bool
+seq_before (unsigned a, unsigned b)
+{
+  return (int) (a - b) < 0;
 }
\ No newline at end of file
@@ -1,15 +1,17 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct heap waiters;        /* Waiting threads, by priority. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -19,22 +21,41 @@ void sema_up (struct semaphore *);
 void sema_self_test (void);
 
 /* Lock. */
+/* Contention statistics kept for named locks.  Every field is
+   updated only by the lock's holder. */
+struct lock_stats
+  {
+    unsigned acquire_cnt;       /* Number of acquisitions. */
+    unsigned contended_cnt;     /* Acquisitions that had to wait. */
+    uint64_t wait_tsc;          /* Total TSC cycles spent waiting. */
+    uint64_t max_hold_tsc;      /* Longest hold, in TSC cycles. */
+    uint64_t acquired_tsc;      /* TSC when last acquired. */
+  };
+
 struct lock 
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct heap donors;         /* Threads waiting for the lock. */
+    int max_priority;           /* Highest priority in donors, or -1. */
+    struct heap_elem held_elem; /* Element in holder's held_locks. */
+    const char *name;           /* Name for statistics, or null. */
+    struct list_elem named_elem; /* Element in list of named locks. */
+    struct lock_stats stats;    /* Statistics, if named. */
   };
 
 void lock_init (struct lock *);
+void lock_init_named (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+void lock_print_stats (void);
 
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct heap waiters;        /* Waiting threads, by priority. */
   };
 
 void cond_init (struct condition *);
@@ -42,7 +63,9 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
-bool compare_semaphore_priority (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
+bool compare_thread_waiter_priority (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED);
+bool compare_semaphore_priority (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED);
+bool compare_lock_priority (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED);
 
 /* Optimization barrier.
 
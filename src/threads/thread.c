@@ -8,10 +8,12 @@
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/sched-trace.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "threads/fixed-point.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -22,18 +24,59 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queue: one FIFO list of THREAD_READY threads per priority
+   level, plus a bitmap whose bit P is set iff ready_queues[P] is
+   non-empty.  Word 0 covers priorities 0...31, word 1 covers
+   32...63, so the highest ready priority is found with a single
+   bit scan. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+static struct list ready_queues[PRI_CNT];
+static uint32_t ready_bitmap[PRI_CNT / 32];
+static int ready_thread_cnt;     /* # of threads in the run queue. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-static struct list sleep_list;
+/* Sleeping threads, kept in a hierarchical timer wheel indexed
+   by wakeup_tick.  sleep_tv1 has one slot per tick for the next
+   SLEEP_TVR_SIZE ticks; each further level has SLEEP_TVN_SIZE
+   slots, each covering a whole revolution of the level below.
+   When sleep_tv1 wraps, the current slot of the next level is
+   "cascaded", i.e. its threads are redistributed into the lower
+   levels.  Insertion is O(1) and every thread is cascaded at
+   most SLEEP_TVN_LEVELS times before it expires.
+
+   wheel_time is the next tick the wheel will process, and
+   next_tick_to_awake the earliest tick at which the wheel needs
+   attention, or INT64_MAX if no thread is sleeping. */
+#define SLEEP_TVR_BITS 8
+#define SLEEP_TVN_BITS 6
+#define SLEEP_TVR_SIZE (1 << SLEEP_TVR_BITS)
+#define SLEEP_TVN_SIZE (1 << SLEEP_TVN_BITS)
+#define SLEEP_TVN_LEVELS 3
+#define SLEEP_MAX_OFFSET \
+  ((1LL << (SLEEP_TVR_BITS + SLEEP_TVN_LEVELS * SLEEP_TVN_BITS)) - 1)
+static struct list sleep_tv1[SLEEP_TVR_SIZE];
+static struct list sleep_tvn[SLEEP_TVN_LEVELS][SLEEP_TVN_SIZE];
+static uint32_t sleep_tv1_bitmap[SLEEP_TVR_SIZE / 32];
+static int sleeper_cnt;                 /* # of threads in the wheel. */
+static int64_t wheel_time;
 static int64_t next_tick_to_awake;
 int load_avg;
 
+/* MLFQS bookkeeping.  Threads whose recent_cpu changed since the
+   last priority pass are kept on mlfqs_dirty_list, so that pass
+   touches only them.  Blocked threads are not decayed once per
+   second; the per-second decay coefficients are remembered in
+   decay_history instead and applied when the thread is next
+   unblocked.  A thread blocked for longer than DECAY_HISTORY
+   seconds gets only the most recent DECAY_HISTORY decays. */
+#define DECAY_HISTORY 64
+static struct list mlfqs_dirty_list;
+static int mlfqs_epoch;                 /* # of seconds decayed. */
+static int decay_history[DECAY_HISTORY];
+
 /* Idle thread. */
 static struct thread *idle_thread;
 
@@ -76,6 +119,15 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_queue_push (struct thread *);
+static void ready_queue_remove (struct thread *);
+static int ready_queue_max_priority (void);
+static struct thread *ready_queue_pop (void);
+static void mlfqs_mark_dirty (struct thread *);
+static void mlfqs_catch_up (struct thread *);
+static void sleep_wheel_insert (struct thread *);
+static void sleep_wheel_cascade (int level, int index);
+static int64_t sleep_wheel_next_event (void);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -93,12 +145,20 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
-  list_init (&sleep_list);
+  for (i = 0; i < SLEEP_TVR_SIZE; i++)
+    list_init (&sleep_tv1[i]);
+  for (i = 0; i < SLEEP_TVN_LEVELS * SLEEP_TVN_SIZE; i++)
+    list_init (&sleep_tvn[i / SLEEP_TVN_SIZE][i % SLEEP_TVN_SIZE]);
+  next_tick_to_awake = INT64_MAX;
+  list_init (&mlfqs_dirty_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -130,9 +190,10 @@ thread_start (void)
 }
 
 /* Called by the timer interrupt handler at each timer tick.
+   USER is true if the tick interrupted user code.
    Thus, this function runs in an external interrupt context. */
 void
-thread_tick (void) 
+thread_tick (bool user) 
 {
   struct thread *t = thread_current ();
 
@@ -146,11 +207,24 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (user)
+    t->usage.user_ticks++;
+  else if (t != idle_thread)
+    t->usage.kernel_ticks++;
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
+/* Credits N timer ticks that passed without a timer interrupt,
+   while the CPU was halted in the idle thread. */
+void
+thread_add_idle_ticks (int64_t n)
+{
+  idle_ticks += n;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
@@ -159,6 +233,35 @@ thread_print_stats (void)
           idle_ticks, kernel_ticks, user_ticks);
 }
 
+/* Stores the running thread's resource usage into USAGE, or the
+   combined usage of its exited children if CHILDREN is true.
+   USAGE must be in kernel memory, because it is written with
+   interrupts off and so must not page fault. */
+void
+thread_get_usage (bool children, struct rusage *usage)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level = intr_disable ();
+
+  *usage = children ? cur->child_usage : cur->usage;
+  intr_set_level (old_level);
+}
+
+/* Adds the usage counted in U to SUM.  Interrupts are disabled
+   because the timer interrupt may be updating U. */
+void
+rusage_add (struct rusage *sum, const struct rusage *u)
+{
+  enum intr_level old_level = intr_disable ();
+
+  sum->user_ticks += u->user_ticks;
+  sum->kernel_ticks += u->kernel_ticks;
+  sum->voluntary_switches += u->voluntary_switches;
+  sum->involuntary_switches += u->involuntary_switches;
+  sum->page_faults += u->page_faults;
+  intr_set_level (old_level);
+}
+
 /* Creates a new kernel thread named NAME with the given initial
    PRIORITY, which executes FUNCTION passing AUX as the argument,
    and adds it to the ready queue.  Returns the thread identifier
@@ -266,8 +369,15 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED); 
-  list_insert_ordered(&ready_list, &t->elem, compare_thread_prority, NULL);
+  if (thread_mlfqs && t->recent_cpu_epoch != mlfqs_epoch)
+    {
+      mlfqs_catch_up (t);
+      recalculate_priority_foreach (t);
+    }
+  ready_queue_push (t);
   t->status = THREAD_READY;
+  sched_trace_record (SCHED_EV_WAKEUP, t->tid, running_thread ()->tid,
+                      t->priority);
   intr_set_level (old_level);
 }
 
@@ -320,6 +430,8 @@ thread_exit (void)
      when it calls thread_schedule_tail(). */
   intr_disable ();
   list_remove (&thread_current()->allelem);
+  if (thread_current ()->mlfqs_dirty)
+    list_remove (&thread_current ()->mlfqs_elem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -337,7 +449,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread)  
-      list_insert_ordered(&ready_list, &cur->elem, compare_thread_prority, NULL);
+      ready_queue_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -441,6 +553,11 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* In tickless mode, stop the periodic tick until the next
+         sleeper is due.  schedule() restarts it as soon as we
+         switch to another thread. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -508,8 +625,9 @@ init_thread (struct thread *t, const char *name, int priority)
     t->priority = priority;
   t->magic = THREAD_MAGIC;
   t->original_priority = priority;
-  list_init(&t->donations_list);
+  heap_init(&t->held_locks, compare_lock_priority, NULL);
   t->waiting_lock = NULL;
+  t->recent_cpu_epoch = mlfqs_epoch;
 
   #ifdef USERPROG
     list_init(&t->children);
@@ -552,10 +670,93 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  if (ready_thread_cnt == 0)
     return idle_thread;
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    return ready_queue_pop ();
+}
+
+/* Appends T to the run queue at its current priority. */
+static void
+ready_queue_push (struct thread *t)
+{
+  int p = t->priority;
+
+  ASSERT (PRI_MIN <= p && p <= PRI_MAX);
+  list_push_back (&ready_queues[p], &t->elem);
+  ready_bitmap[p / 32] |= 1u << (p % 32);
+  ready_thread_cnt++;
+}
+
+/* Removes T, which must be in the run queue, from it. */
+static void
+ready_queue_remove (struct thread *t)
+{
+  int p = t->priority;
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[p]))
+    ready_bitmap[p / 32] &= ~(1u << (p % 32));
+  ready_thread_cnt--;
+}
+
+/* Returns the highest priority of any thread in the run queue,
+   or -1 if the run queue is empty. */
+static int
+ready_queue_max_priority (void)
+{
+  int i;
+
+  for (i = PRI_CNT / 32 - 1; i >= 0; i--)
+    if (ready_bitmap[i] != 0)
+      return i * 32 + 31 - __builtin_clz (ready_bitmap[i]);
+  return -1;
+}
+
+/* Removes and returns the first thread at the highest non-empty
+   priority level.  The run queue must not be empty. */
+static struct thread *
+ready_queue_pop (void)
+{
+  int p = ready_queue_max_priority ();
+  struct thread *t;
+
+  ASSERT (p >= 0);
+  t = list_entry (list_front (&ready_queues[p]), struct thread, elem);
+  ready_queue_remove (t);
+  return t;
+}
+
+/* Sets T's effective priority to PRIORITY, clamped to
+   PRI_MIN...PRI_MAX, moving T to the matching run queue level if
+   it is ready and reordering the wait queue it is on, if any. */
+void
+thread_change_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level;
+
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+
+  old_level = intr_disable ();
+  if (t->status == THREAD_READY && t != idle_thread
+      && t->priority != priority)
+    {
+      ready_queue_remove (t);
+      t->priority = priority;
+      ready_queue_push (t);
+    }
+  else
+    t->priority = priority;
+
+  /* A thread may still be on a wait queue while it is ready,
+     e.g. in cond_wait() between adding itself to the condition's
+     waiters and sleeping on its semaphore. */
+  if (t->waiting_heap != NULL)
+    heap_update (t->waiting_heap, t->waiting_elem);
+  intr_set_level (old_level);
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -615,15 +816,34 @@ static void
 schedule (void) 
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
+  struct thread *next;
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
+
+  /* Catch up on ticks missed by a tickless idle period, which
+     may wake sleepers, before choosing the next thread. */
+  if (cur == idle_thread)
+    timer_idle_exit ();
+  next = next_thread_to_run ();
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      /* The idle thread is not a process; don't count its
+         switches. */
+      if (cur != idle_thread)
+        {
+          if (cur->status == THREAD_READY)
+            cur->usage.involuntary_switches++;
+          else
+            cur->usage.voluntary_switches++;
+        }
+
+      sched_trace_record (SCHED_EV_SWITCH, cur->tid, next->tid, cur->status);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -650,143 +870,296 @@ thread_sleep(int64_t wakeup_tick)
 {
   struct thread *current_thread = thread_current();
   enum intr_level old_level = intr_disable();
+
+  /* An empty wheel is not advanced by thread_awake(), so bring
+     it up to date before using it as the insertion reference. */
+  if (sleeper_cnt == 0)
+    wheel_time = timer_ticks () + 1;
+
   current_thread->wakeup_tick = wakeup_tick;
-  list_insert_ordered(&sleep_list, &current_thread->elem, compare_wakeup_ticks, NULL);
-  if (wakeup_tick < next_tick_to_awake) {
-      next_tick_to_awake = wakeup_tick;
-  }
+  sleep_wheel_insert (current_thread);
+  next_tick_to_awake = sleep_wheel_next_event ();
+  sched_trace_record (SCHED_EV_SLEEP, current_thread->tid, 0, wakeup_tick);
   thread_block();
   intr_set_level(old_level);
 }
 
-
+/* Wakes up every sleeping thread whose wakeup_tick is at most
+   CURRENT_TICKS, advancing the wheel up to CURRENT_TICKS. */
 void 
 thread_awake(int64_t current_ticks) 
 {
-    struct list_elem *e = list_begin(&sleep_list);
-    
-    while (e != list_end(&sleep_list)) {
-        struct thread *t = list_entry(e, struct thread, elem);
-        if (t->wakeup_tick <= current_ticks) {
-            e = list_remove(e); 
-            thread_unblock(t);   
-        } 
-        else {
-            next_tick_to_awake = t->wakeup_tick;
-            break;
-        }
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (sleeper_cnt > 0 && wheel_time <= current_ticks) {
+    int64_t next = sleep_wheel_next_event ();
+    int index;
+
+    /* Skip straight over ticks with nothing to do. */
+    if (next > current_ticks) {
+      wheel_time = current_ticks + 1;
+      break;
     }
+    wheel_time = next;
+    index = wheel_time & (SLEEP_TVR_SIZE - 1);
+
+    if (index == 0) {
+      int level;
+      for (level = 0; level < SLEEP_TVN_LEVELS; level++) {
+        int tvn_index = (wheel_time >> (SLEEP_TVR_BITS + level * SLEEP_TVN_BITS))
+                        & (SLEEP_TVN_SIZE - 1);
+        sleep_wheel_cascade (level, tvn_index);
+        if (tvn_index != 0)
+          break;
+      }
+    }
+
+    while (!list_empty (&sleep_tv1[index])) {
+      struct thread *t = list_entry (list_pop_front (&sleep_tv1[index]), struct thread, elem);
+      sleeper_cnt--;
+      thread_unblock (t);
+    }
+    sleep_tv1_bitmap[index / 32] &= ~(1u << (index % 32));
+    wheel_time++;
+  }
+
+  next_tick_to_awake = sleeper_cnt > 0 ? sleep_wheel_next_event () : INT64_MAX;
 }
 
-int
+int64_t
 get_next_tick_to_awake (void) 
 {
   return next_tick_to_awake;
 }
 
-bool 
-compare_wakeup_ticks(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-  const struct thread *thread_a = list_entry(a, struct thread, elem);
-  const struct thread *thread_b = list_entry(b, struct thread, elem);
+/* Puts sleeping thread T into the wheel slot for its
+   wakeup_tick, relative to wheel_time.  Threads that should
+   already have woken go into the slot processed next; threads
+   beyond the wheel's range park in the last slot of the top
+   level and are re-inserted each time they are cascaded. */
+static void
+sleep_wheel_insert (struct thread *t)
+{
+  int64_t expires = t->wakeup_tick;
+  int64_t offset;
+  int level;
+
+  if (expires < wheel_time)
+    expires = wheel_time;
+  offset = expires - wheel_time;
+  if (offset > SLEEP_MAX_OFFSET)
+    {
+      offset = SLEEP_MAX_OFFSET;
+      expires = wheel_time + offset;
+    }
+
+  sleeper_cnt++;
+  if (offset < SLEEP_TVR_SIZE)
+    {
+      int index = expires & (SLEEP_TVR_SIZE - 1);
+      list_push_back (&sleep_tv1[index], &t->elem);
+      sleep_tv1_bitmap[index / 32] |= 1u << (index % 32);
+      return;
+    }
 
-  return thread_a->wakeup_tick < thread_b->wakeup_tick;
+  for (level = 0; level < SLEEP_TVN_LEVELS - 1; level++)
+    if (offset < 1LL << (SLEEP_TVR_BITS + (level + 1) * SLEEP_TVN_BITS))
+      break;
+  list_push_back (&sleep_tvn[level][(expires >> (SLEEP_TVR_BITS + level * SLEEP_TVN_BITS))
+                                    & (SLEEP_TVN_SIZE - 1)],
+                  &t->elem);
 }
 
-bool 
-compare_thread_prority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-  const struct thread *thread_a = list_entry(a, struct thread, elem);
-  const struct thread *thread_b = list_entry(b, struct thread, elem);
-  
-  return thread_a->priority > thread_b->priority;
+/* Moves every thread in slot INDEX of upper LEVEL back into the
+   wheel, which places each one at a lower level. */
+static void
+sleep_wheel_cascade (int level, int index)
+{
+  struct list *slot = &sleep_tvn[level][index];
+
+  while (!list_empty (slot))
+    {
+      struct thread *t = list_entry (list_pop_front (slot), struct thread, elem);
+      sleeper_cnt--;
+      sleep_wheel_insert (t);
+    }
+}
+
+/* Returns the first tick at or after wheel_time at which the
+   wheel has work to do: either a non-empty sleep_tv1 slot or,
+   failing that, the next wrap of sleep_tv1, where the upper
+   levels are cascaded. */
+static int64_t
+sleep_wheel_next_event (void)
+{
+  int index = wheel_time & (SLEEP_TVR_SIZE - 1);
+  int64_t base = wheel_time - index;
+  int word = index / 32;
+  uint32_t bits = sleep_tv1_bitmap[word] & (~0u << (index % 32));
+
+  for (;;)
+    {
+      if (bits != 0)
+        return base + word * 32 + __builtin_ctz (bits);
+      if (++word == SLEEP_TVR_SIZE / 32)
+        return base + SLEEP_TVR_SIZE;
+      bits = sleep_tv1_bitmap[word];
+    }
 }
 
 void 
 thread_preemption(void) {
-  if (!list_empty(&ready_list)){
-    struct thread *cur = thread_current ();
-    struct thread *most_priority_thread = list_entry(list_front(&ready_list), struct thread, elem);
-    if (cur->priority < most_priority_thread->priority){
-      if (intr_context())
-        intr_yield_on_return();
-      else
-        thread_yield();
-    }
+  if (thread_current ()->priority < ready_queue_max_priority ()){
+    if (intr_context())
+      intr_yield_on_return();
+    else
+      thread_yield();
   }
 }
 
+/* Returns T's priority including donations: the higher of its
+   own priority and the highest priority waiting for any lock it
+   holds.  Each lock summarizes its waiters in max_priority and
+   held_locks is ordered by that summary, so this is O(1). */
+static int
+effective_priority (struct thread *t)
+{
+  int priority = t->original_priority;
+  struct heap_elem *top = heap_top (&t->held_locks);
+
+  if (top != NULL
+      && heap_entry (top, struct lock, held_elem)->max_priority > priority)
+    priority = heap_entry (top, struct lock, held_elem)->max_priority;
+  return priority;
+}
+
 void
 update_priority(void) {
+  enum intr_level old_level = intr_disable ();
   struct thread *cur = thread_current();
-  cur->priority = cur->original_priority;
-  if (!list_empty(&cur->donations_list)) {
-    list_sort(&cur->donations_list, compare_thread_donator_priority, NULL);
-    struct thread *max_priority_donator = list_entry(list_front(&cur->donations_list), struct thread, donator);
-    if (max_priority_donator->priority > cur->priority)
-      cur->priority = max_priority_donator->priority;
-  }
+  thread_change_priority (cur, effective_priority (cur));
+  intr_set_level (old_level);
 }
 
+/* Makes CUR, which is about to wait for LOCK, a donor of LOCK
+   and raises the priority of the chain of lock holders starting
+   at LOCK's holder, up to 8 levels deep.  Each level costs
+   O(log n) heap updates, and propagation stops at the first
+   holder whose priority does not change.  Must be called with
+   interrupts off. */
 void 
 nested_donation(struct lock *lock, struct thread* cur){
-  int level = 0, max_priority = cur->priority;
-  struct lock *waiting_lock = lock;
-  struct thread *lock_holder;
-  while (level < 8){
-    if (!waiting_lock) break;
-    lock_holder = waiting_lock->holder;
-    if (lock_holder->priority >= max_priority)
-      max_priority = lock_holder->priority;
-    else{ 
-      lock_holder->priority = max_priority;
-    }
-    waiting_lock = lock_holder->waiting_lock;
-    level++;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  heap_push (&lock->donors, &cur->donor_elem);
+  for (level = 0; lock != NULL && level < 8; level++){
+    struct thread *lock_holder = lock->holder;
+    int max_priority = heap_entry (heap_top (&lock->donors), struct thread, donor_elem)->priority;
+    int priority;
+
+    if (lock_holder == NULL || max_priority <= lock->max_priority)
+      break;
+    lock->max_priority = max_priority;
+    heap_update (&lock_holder->held_locks, &lock->held_elem);
+
+    priority = effective_priority (lock_holder);
+    if (priority == lock_holder->priority)
+      break;
+    thread_change_priority (lock_holder, priority);
+    sched_trace_record (SCHED_EV_DONATE, cur->tid, lock_holder->tid, priority);
+
+    lock = lock_holder->waiting_lock;
+    if (lock != NULL)
+      heap_update (&lock->donors, &lock_holder->donor_elem);
   }
 }
 
+/* Orders threads waiting for a lock by ascending priority. */
 bool
-compare_thread_donator_priority (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-	return list_entry(a, struct thread, donator)->priority > list_entry(b, struct thread, donator)->priority;
+compare_thread_donator_priority (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED) {
+	return heap_entry(a, struct thread, donor_elem)->priority < heap_entry(b, struct thread, donor_elem)->priority;
 }
 
 void
 recalculate_priority_foreach(struct thread *t){
   if (t != idle_thread)
-    t->priority = convert_fixed_to_int_zero(fixed_add_int(fixed_divide_int(t->recent_cpu, -4), PRI_MAX - t->nice * 2));
+    thread_change_priority (t, convert_fixed_to_int_zero(fixed_add_int(fixed_divide_int(t->recent_cpu, -4), PRI_MAX - t->nice * 2)));
 }
 
+/* Recomputes the priority of every thread whose recent_cpu
+   changed since the last call. */
 void
 recalculate_priority(void){
-  struct list_elem *e;
-  for (e = list_begin (&all_list); e != list_end (&all_list); e = list_next (e))
-    recalculate_priority_foreach(list_entry(e, struct thread, allelem));
-  if (!list_empty(&ready_list))
-    list_sort(&ready_list, compare_thread_prority, NULL);
+  while (!list_empty (&mlfqs_dirty_list)) {
+    struct thread *t = list_entry (list_pop_front (&mlfqs_dirty_list), struct thread, mlfqs_elem);
+    t->mlfqs_dirty = false;
+    recalculate_priority_foreach(t);
+  }
 }
 
 void
 increment_recent_cpu(void){
   struct thread *cur = thread_current();
-  if (cur != idle_thread)
+  if (cur != idle_thread) {
     cur->recent_cpu = fixed_add_int(cur->recent_cpu, 1);  
+    mlfqs_mark_dirty (cur);
+  }
 }
 
 void
 recalculate_recent_cpu_foreach(struct thread *t){
-  if (t != idle_thread)
-    t->recent_cpu = fixed_add_int(fixed_multiply(fixed_divide(fixed_multiply_int(load_avg, 2), fixed_add_int(fixed_multiply_int(load_avg, 2),1)), t->recent_cpu), t->nice);
+  if (t != idle_thread) {
+    mlfqs_catch_up (t);
+    mlfqs_mark_dirty (t);
+  }
 }
 
+/* Starts a new one-second decay epoch and decays the running and
+   ready threads.  Blocked threads catch up in thread_unblock(). */
 void 
 recalculate_recent_cpu(void){
+  int p;
   struct list_elem *e;
-  for (e = list_begin (&all_list); e != list_end (&all_list); e = list_next (e))
-    recalculate_recent_cpu_foreach(list_entry(e, struct thread, allelem));
+
+  decay_history[mlfqs_epoch % DECAY_HISTORY] = fixed_divide(fixed_multiply_int(load_avg, 2), fixed_add_int(fixed_multiply_int(load_avg, 2),1));
+  mlfqs_epoch++;
+
+  recalculate_recent_cpu_foreach(thread_current ());
+  for (p = ready_queue_max_priority (); p >= PRI_MIN; p--)
+    for (e = list_begin (&ready_queues[p]); e != list_end (&ready_queues[p]); e = list_next (e))
+      recalculate_recent_cpu_foreach(list_entry(e, struct thread, elem));
+}
+
+/* Queues T for the next recalculate_priority() pass. */
+static void
+mlfqs_mark_dirty (struct thread *t)
+{
+  if (!t->mlfqs_dirty)
+    {
+      t->mlfqs_dirty = true;
+      list_push_back (&mlfqs_dirty_list, &t->mlfqs_elem);
+    }
+}
+
+/* Applies to T's recent_cpu the decays of every epoch that
+   elapsed since T was last brought up to date. */
+static void
+mlfqs_catch_up (struct thread *t)
+{
+  int epoch = t->recent_cpu_epoch;
+
+  if (epoch < mlfqs_epoch - DECAY_HISTORY)
+    epoch = mlfqs_epoch - DECAY_HISTORY;
+  for (; epoch < mlfqs_epoch; epoch++)
+    t->recent_cpu = fixed_add_int(fixed_multiply(decay_history[epoch % DECAY_HISTORY], t->recent_cpu), t->nice);
+  t->recent_cpu_epoch = mlfqs_epoch;
 }
 
 void
 recalculate_load_avg(void) {
-  int ready_threads = thread_current() != idle_thread ? list_size(&ready_list) + 1 : list_size(&ready_list);
+  int ready_threads = thread_current() != idle_thread ? ready_thread_cnt + 1 : ready_thread_cnt;
   load_avg = fixed_add(fixed_multiply(fixed_divide_int(convert_int_to_fixed(59),60), load_avg), fixed_divide_int(convert_int_to_fixed(ready_threads), 60));
 }
 
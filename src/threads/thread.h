@@ -2,6 +2,8 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <heap.h>
+#include <rusage.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/synch.h"
@@ -85,10 +87,11 @@ typedef int tid_t;
    value, triggering the assertion. */
 /* The `elem' member has a dual purpose.  It can be an element in
    the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+   sleep queue (thread.c, devices/timer.c).  It can be used these
+   two ways only because they are mutually exclusive: only a
+   thread in the ready state is on the run queue, whereas only a
+   thread in the blocked state is on a sleep queue.  Semaphore
+   wait queues use `waiter_elem' instead. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -99,15 +102,26 @@ struct thread
     int priority;                       /* Priority. */
     struct list_elem allelem;           /* List element for all threads list. */
     int64_t wakeup_tick; 
+    uint64_t wakeup_tsc;                /* Sub-tick sleep deadline. */
     int original_priority;
-    struct list donations_list;
+    struct heap held_locks;             /* Locks held, by max_priority. */
     struct lock *waiting_lock;
-    struct list_elem donator;
+    struct heap_elem donor_elem;        /* Element in lock's donors. */
     int nice;
     int recent_cpu;
+    int recent_cpu_epoch;               /* Last decay epoch applied. */
+    bool mlfqs_dirty;                   /* On the MLFQS dirty list? */
+    struct list_elem mlfqs_elem;        /* MLFQS dirty list element. */
+    struct rusage usage;                /* CPU and page fault usage. */
+    struct rusage child_usage;          /* Usage of exited children. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct heap_elem waiter_elem;       /* Semaphore waiters element. */
+    unsigned waiter_seq;                /* FIFO tiebreak in waiters. */
+    struct heap *waiting_heap;          /* Priority-ordered wait queue
+                                           containing waiting_elem. */
+    struct heap_elem *waiting_elem;
     
      
     /* Owned by userprog/process.c. */
@@ -146,8 +160,11 @@ extern bool thread_mlfqs;
 void thread_init (void);
 void thread_start (void);
 
-void thread_tick (void);
+void thread_tick (bool user);
+void thread_add_idle_ticks (int64_t n);
 void thread_print_stats (void);
+void thread_get_usage (bool children, struct rusage *);
+void rusage_add (struct rusage *sum, const struct rusage *);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -164,8 +181,7 @@ void thread_yield (void);
 
 void thread_sleep (int64_t wakeup_tick);
 void thread_awake (int64_t current_tick);
-int get_next_tick_to_awake (void);
-bool compare_wakeup_ticks(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
+int64_t get_next_tick_to_awake (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -179,11 +195,11 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-bool compare_thread_prority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
 void thread_preemption(void);
+void thread_change_priority (struct thread *t, int priority);
 void nested_donation(struct lock *lock, struct thread* cur);
 void update_priority (void);
-bool compare_thread_donator_priority (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
+bool compare_thread_donator_priority (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED);
 
 void recalculate_priority_foreach(struct thread *t);
 void recalculate_priority(void);
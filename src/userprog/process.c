@@ -171,6 +171,8 @@ process_exit (void)
   uint32_t *pd;
 
   if (cur->parent != NULL) {
+    rusage_add (&cur->parent->child_usage, &cur->usage);
+    rusage_add (&cur->parent->child_usage, &cur->child_usage);
     list_remove(&cur->child);
     sema_up(&cur->parent->wait_sema);
     if (!cur->parent->is_child_loaded)
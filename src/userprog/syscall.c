@@ -11,6 +11,7 @@
 #include "threads/synch.h"
 #include "userprog/pagedir.h"
 #include "devices/input.h"
+#include "devices/block.h"
 #include "threads/malloc.h"
 #include <round.h>
 #include "vm/page.h"
@@ -23,7 +24,7 @@ void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&fs_lock);
+  lock_init_named(&fs_lock, "fs");
 }
 
 static void
@@ -82,6 +83,12 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_MUNMAP:
       munmap(args[1]);
       break;
+    case SYS_GETRUSAGE:
+      f->eax = getrusage(args[1], (struct rusage*) args[2]);
+      break;
+    case SYS_IOSTAT:
+      f->eax = iostat(args[1], (struct iostat*) args[2]);
+      break;
     default:
       exit(-1);
   }
@@ -358,4 +365,36 @@ void munmap(mapid_t mapping) {
       return;
     }
   }
-}
\ No newline at end of file
+}
+
+bool
+getrusage (int who, struct rusage *usage) {
+  struct rusage snapshot;
+
+  if (who != RUSAGE_SELF && who != RUSAGE_CHILDREN)
+    return false;
+  check_buffer_validity(usage, sizeof *usage);
+
+  /* Copy out with interrupts on, since USAGE may fault. */
+  thread_get_usage(who == RUSAGE_CHILDREN, &snapshot);
+  *usage = snapshot;
+  return true;
+}
+
+bool
+iostat (int role, struct iostat *stats) {
+  struct iostat snapshot;
+  struct block *block;
+
+  if (role < IOSTAT_KERNEL || role > IOSTAT_SWAP)
+    return false;
+  check_buffer_validity(stats, sizeof *stats);
+  block = block_get_role(role);
+  if (block == NULL)
+    return false;
+
+  /* Copy out with interrupts on, since STATS may fault. */
+  block_get_stats(block, &snapshot);
+  *stats = snapshot;
+  return true;
+}
@@ -2,6 +2,8 @@
 #define USERPROG_SYSCALL_H
 #include <stdbool.h>
 #include <list.h>
+#include <rusage.h>
+#include <iostat.h>
 
 typedef int pid_t;
 
@@ -37,4 +39,7 @@ struct file_mapping
 mapid_t mmap(int fd, void* addr);
 void munmap(mapid_t mapping);
 
+bool getrusage (int who, struct rusage *usage);
+bool iostat (int role, struct iostat *stats);
+
 #endif /* userprog/syscall.h */
@@ -14,7 +14,7 @@ struct lock frame_table_lock;
 void 
 frame_init(void) 
 {
-  lock_init(&frame_table_lock); 
+  lock_init_named(&frame_table_lock, "frame_table"); 
   list_init(&frame_table);
 }
 
@@ -7,6 +7,7 @@
 #include "vm/page.h"
 #include <stdbool.h>
 #include "threads/palloc.h"
+#include "userprog/pagedir.h"
 #include "userprog/process.h"
 
 #define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
@@ -24,7 +25,7 @@ void swap_init(void)
     else {
         swap_table = bitmap_create(block_size(swap_block) / SECTORS_PER_PAGE);
     }
-    lock_init(&swap_lock);
+    lock_init_named(&swap_lock, "swap");
 }
 
 void
@@ -34,10 +35,10 @@ swap_out(struct spt_entry* page) {
     if (slot_index == BITMAP_ERROR) {
         lock_release(&swap_lock);
     }
-    size_t i;
-    for (i = 0; i < SECTORS_PER_PAGE; i++){
-        block_write(swap_block, slot_index * SECTORS_PER_PAGE + i, (uint8_t *) page->page + i * BLOCK_SECTOR_SIZE );
-    }
+    /* Go through the frame's kernel address, which the disk
+       driver can DMA from, rather than the user address. */
+    void *kpage = pagedir_get_page(page->owner->pagedir, page->page);
+    block_write_multi(swap_block, slot_index * SECTORS_PER_PAGE, SECTORS_PER_PAGE, kpage);
     lock_release(&swap_lock); 
     page->swap_index = slot_index;
     page->pinning = false;
@@ -56,9 +57,7 @@ swap_in(struct spt_entry *spte) {
     }
     lock_acquire(&swap_lock);
     spte->type = FILE;
-    size_t i;
-    for (i = 0; i < SECTORS_PER_PAGE; i++)
-        block_read (swap_block, spte->swap_index * SECTORS_PER_PAGE + i, spte->page + i * BLOCK_SECTOR_SIZE);
+    block_read_multi(swap_block, spte->swap_index * SECTORS_PER_PAGE, SECTORS_PER_PAGE, frame);
     bitmap_reset (swap_table, spte->swap_index);
     lock_release(&swap_lock);
     return true;